@@ -0,0 +1,71 @@
+#include "admission.hpp"
+#include "respone_header.hpp"
+
+void AdmissionControl::configure(unsigned int max_connections,
+                                 unsigned int max_queued_requests,
+                                 unsigned int retry_after) {
+  this->max_connections = max_connections;
+  this->max_queued_requests = max_queued_requests;
+  // Rendered once, a shed client costs a single write
+  this->response = std::string(get_status_line(503)) +
+                   "Retry-After: " + std::to_string(retry_after) +
+                   "\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+}
+
+bool AdmissionControl::take_slot(std::atomic<unsigned int> &counter,
+                                 unsigned int limit) {
+  if (limit == 0) {
+    counter.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  unsigned int current = counter.load(std::memory_order_relaxed);
+  while (current < limit) {
+    if (counter.compare_exchange_weak(current, current + 1,
+                                      std::memory_order_relaxed))
+      return true;
+  }
+  return false;
+}
+
+bool AdmissionControl::admit_connection() {
+  if (this->take_slot(this->open_connections, this->max_connections))
+    return true;
+  this->shed_connection_count.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void AdmissionControl::release_connection() {
+  this->open_connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool AdmissionControl::admit_request() {
+  if (this->take_slot(this->queued_requests, this->max_queued_requests))
+    return true;
+  this->shed_request_count.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void AdmissionControl::release_requests(unsigned int count) {
+  if (count > 0)
+    this->queued_requests.fetch_sub(count, std::memory_order_relaxed);
+}
+
+const std::string &AdmissionControl::overload_response() const {
+  return this->response;
+}
+
+unsigned long long AdmissionControl::shed_connections() const {
+  return this->shed_connection_count.load(std::memory_order_relaxed);
+}
+
+unsigned long long AdmissionControl::shed_requests() const {
+  return this->shed_request_count.load(std::memory_order_relaxed);
+}
+
+unsigned int AdmissionControl::connections() const {
+  return this->open_connections.load(std::memory_order_relaxed);
+}
+
+unsigned int AdmissionControl::queued() const {
+  return this->queued_requests.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,65 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <atomic>
+#include <string>
+
+/*
+ * Admission control shared by all event loops. Connections and requests past
+ * the configured limits are shed with a pre-rendered 503 right away, so the
+ * admitted ones keep a bounded latency during traffic spikes.
+ */
+class AdmissionControl {
+public:
+  /*
+   * @param max_connections Clients served at the same time (0 = no limit)
+   * @param max_queued_requests Requests answered but not yet sent out
+   * (0 = no limit)
+   * @param retry_after Seconds a shed client is told to wait
+   */
+  void configure(unsigned int max_connections,
+                 unsigned int max_queued_requests, unsigned int retry_after);
+
+  /*
+   * Takes a connection slot, counts the connection as shed if none is left
+   * @return True if the client may be served
+   */
+  bool admit_connection();
+  void release_connection();
+
+  /*
+   * Takes a slot in the request queue, counts the request as shed if none is
+   * left
+   * @return True if the request may be evaluated
+   */
+  bool admit_request();
+  void release_requests(unsigned int count);
+
+  /*
+   * The complete 503 response (with Retry-After and Connection: close) the
+   * shed clients get
+   */
+  const std::string &overload_response() const;
+
+  unsigned long long shed_connections() const;
+  unsigned long long shed_requests() const;
+  // The slots taken right now
+  unsigned int connections() const;
+  unsigned int queued() const;
+
+private:
+  unsigned int max_connections = 0;
+  unsigned int max_queued_requests = 0;
+  std::string response;
+  std::atomic<unsigned int> open_connections{0};
+  std::atomic<unsigned int> queued_requests{0};
+  std::atomic<unsigned long long> shed_connection_count{0};
+  std::atomic<unsigned long long> shed_request_count{0};
+
+  /*
+   * Increments the counter if it stays within the limit
+   */
+  bool take_slot(std::atomic<unsigned int> &counter, unsigned int limit);
+};
+
+#endif // !ADMISSION_H
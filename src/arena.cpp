@@ -0,0 +1,80 @@
+#include "arena.hpp"
+#include <cstdint>
+#include <new>
+
+Arena::~Arena() {
+  this->free_overflow();
+  if (this->first != this->inline_block) {
+    ::operator delete(this->first);
+  }
+}
+
+void Arena::reset() {
+  std::size_t needed = this->used + this->offset;
+  this->free_overflow();
+
+  // The requests didn't fit into the first block, the next ones get one
+  // they fit into
+  if (needed > this->first_size && needed <= MAX_RETAINED_SIZE) {
+    std::size_t size = this->first_size;
+    while (size < needed)
+      size *= 2;
+    char *block = static_cast<char *>(::operator new(size, std::nothrow));
+    if (block != nullptr) {
+      if (this->first != this->inline_block)
+        ::operator delete(this->first);
+      this->first = block;
+      this->first_size = size;
+    }
+  }
+
+  this->current = this->first;
+  this->current_size = this->first_size;
+  this->offset = 0;
+  this->used = 0;
+}
+
+void *Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+  uintptr_t start = reinterpret_cast<uintptr_t>(this->current) + this->offset;
+  std::size_t padding = -start & (alignment - 1);
+  if (this->offset + padding + bytes <= this->current_size) {
+    this->offset += padding + bytes;
+    return reinterpret_cast<void *>(start + padding);
+  }
+
+  // Continue in a new block, at least twice the size of the last one
+  std::size_t size = this->current_size * 2;
+  while (size < bytes + alignment + sizeof(Overflow))
+    size *= 2;
+  Overflow *block = static_cast<Overflow *>(::operator new(size));
+  block->next = this->overflow;
+  block->size = size;
+  this->overflow = block;
+
+  this->used += this->offset;
+  this->current = reinterpret_cast<char *>(block + 1);
+  this->current_size = size - sizeof(Overflow);
+  this->offset = 0;
+  return this->do_allocate(bytes, alignment);
+}
+
+void Arena::do_deallocate(void *p, std::size_t bytes, std::size_t) {
+  // Only the latest allocation can be given back, e.g. a growing buffer
+  char *start = static_cast<char *>(p);
+  if (start >= this->current && start + bytes == this->current + this->offset) {
+    this->offset -= bytes;
+  }
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource &other) const
+    noexcept {
+  return this == &other;
+}
+
+void Arena::free_overflow() {
+  while (this->overflow != nullptr) {
+    Overflow *next = this->overflow->next;
+    ::operator delete(this->overflow);
+    this->overflow = next;
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+/*
+ * A bump allocator for the request-scoped memory of one connection: the
+ * resolved path, the header lines and small bodies of the responses. Freeing
+ * single allocations does (almost) nothing, everything is dropped at once
+ * when the connection has no request in flight anymore. The first block lives
+ * inside the arena, a connection whose requests need more gets a bigger block
+ * on the next reset, so handling requests of a steady size doesn't touch the
+ * global allocator.
+ */
+class Arena : public std::pmr::memory_resource {
+public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena();
+
+  /*
+   * Drops everything allocated since the last reset, nothing allocated from
+   * the arena may be used afterwards
+   */
+  void reset();
+
+private:
+  // Blocks beyond the first one, chained through a header in front
+  struct Overflow {
+    Overflow *next;
+    std::size_t size;
+  };
+
+  static const std::size_t INLINE_SIZE = 2048;
+  // The largest first block a connection keeps between its requests
+  static const std::size_t MAX_RETAINED_SIZE = 64 << 10;
+
+  alignas(std::max_align_t) char inline_block[INLINE_SIZE];
+  char *first = inline_block; // The block every request starts in
+  std::size_t first_size = INLINE_SIZE;
+  char *current = inline_block; // The block allocations are bumped from
+  std::size_t current_size = INLINE_SIZE;
+  std::size_t offset = 0;   // The used bytes of the current block
+  std::size_t used = 0;     // The bytes of the full blocks since the reset
+  Overflow *overflow = nullptr;
+
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override;
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override;
+  void free_overflow();
+};
+
+#endif // !ARENA_H
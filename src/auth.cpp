@@ -1,12 +1,34 @@
 #include "auth.hpp"
+#include "http_date.hpp"
+#include <atomic>
 #include <fstream>
 #include <iostream>
-#include <unordered_set>
+#include <set>
+#include <sys/stat.h>
 
-const std::string LIST_FILE = "./server_lists.serverconf";
+// Bumped whenever the list file is known to have changed
+std::atomic<unsigned int> LIST_GENERATION{0};
+
+/*
+ * A section of the list file as this thread read it last, read again once
+ * the file changed
+ */
+struct CachedList {
+  bool loaded = false;
+  struct timespec mtime = {0, 0};
+  off_t size = 0;
+  ino_t inode = 0;
+  std::time_t checked = 0; // The second the file was last compared
+  unsigned int generation = 0;
+  std::set<std::string, std::less<>> entries;
+};
+
+thread_local CachedList WHITELIST;
+thread_local CachedList DELETELIST;
+thread_local CachedList POST_PUT_LIST;
 
 bool load_list(const std::string &list_file, const std::string &section,
-               std::unordered_set<std::string> &list) {
+               std::set<std::string, std::less<>> &list) {
   std::ifstream file(list_file);
   if (!file.is_open()) {
     std::cerr << "Failed to open list file: " << list_file << std::endl;
@@ -31,29 +53,55 @@ bool load_list(const std::string &list_file, const std::string &section,
   return true;
 }
 
-bool access_allowed(const std::string &filename) {
-  std::unordered_set<std::string> whitelist;
-  if (!load_list(LIST_FILE, "whitelist", whitelist)) {
+/*
+ * Checks the list against the file with a stat (at most once a second) and
+ * looks the file name up
+ */
+bool listed(CachedList &list, const std::string &section,
+            std::string_view filename) {
+  std::time_t now = current_second();
+  unsigned int generation = LIST_GENERATION.load(std::memory_order_acquire);
+  if (list.loaded && list.checked == now && list.generation == generation) {
+    return list.entries.find(filename) != list.entries.end();
+  }
+
+  struct stat result;
+  if (stat(LIST_FILE, &result) != 0) {
+    std::cerr << "Failed to open list file: " << LIST_FILE << std::endl;
+    list.loaded = false;
     return false;
   }
 
-  return whitelist.find(filename) != whitelist.end();
+  if (!list.loaded || result.st_mtim.tv_sec != list.mtime.tv_sec ||
+      result.st_mtim.tv_nsec != list.mtime.tv_nsec ||
+      result.st_size != list.size || result.st_ino != list.inode) {
+    list.entries.clear();
+    list.loaded = load_list(LIST_FILE, section, list.entries);
+    if (!list.loaded) {
+      return false;
+    }
+    list.mtime = result.st_mtim;
+    list.size = result.st_size;
+    list.inode = result.st_ino;
+  }
+  list.checked = now;
+  list.generation = generation;
+
+  return list.entries.find(filename) != list.entries.end();
 }
 
-bool allowed_to_delete(const std::string &filename) {
-  std::unordered_set<std::string> deletelist;
-  if (!load_list(LIST_FILE, "deletelist", deletelist)) {
-    return false;
-  }
+bool access_allowed(std::string_view filename) {
+  return listed(WHITELIST, "whitelist", filename);
+}
 
-  return deletelist.find(filename) != deletelist.end();
+bool allowed_to_delete(std::string_view filename) {
+  return listed(DELETELIST, "deletelist", filename);
 }
 
-bool allowed_to_post_put(const std::string &filename) {
-  std::unordered_set<std::string> deletelist;
-  if (!load_list(LIST_FILE, "post_put_list", deletelist)) {
-    return false;
-  }
+bool allowed_to_post_put(std::string_view filename) {
+  return listed(POST_PUT_LIST, "post_put_list", filename);
+}
 
-  return deletelist.find(filename) != deletelist.end();
+void reload_lists() {
+  LIST_GENERATION.fetch_add(1, std::memory_order_release);
 }
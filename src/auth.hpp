@@ -1,27 +1,36 @@
 #ifndef AUTH_H
 #define AUTH_H
 
-#include <string>
+#include <string_view>
+
+// The whitelist, deletelist and post_put_list of the server
+const char LIST_FILE[] = "./server_lists.serverconf";
 
 /*
  * A function that checks if the file is contained within the whitelist of the
  * server
  * @param filename The file to check
  */
-bool access_allowed(const std::string &filename);
+bool access_allowed(std::string_view filename);
 
 /*
  * A function that checks if the file is contained within the deletelist of the
  * server
  * @param filename The file to check
  */
-bool allowed_to_delete(const std::string &filename);
+bool allowed_to_delete(std::string_view filename);
 
 /*
  * A function that checks if the file is contained within the post_put_list of
  * the server
  * @param filename The file to check
  */
-bool allowed_to_post_put(const std::string &filename);
+bool allowed_to_post_put(std::string_view filename);
+
+/*
+ * Makes every thread read the list file again on its next check, for when the
+ * list file is known to have changed
+ */
+void reload_lists();
 
 #endif // !AUTH_H
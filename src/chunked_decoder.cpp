@@ -0,0 +1,143 @@
+#include "chunked_decoder.hpp"
+
+// The longest chunk extension or trailer line that is skipped
+const std::size_t MAX_LINE_LENGTH = 8192;
+// 16 hex digits fill the 64 bit size
+const std::size_t MAX_SIZE_DIGITS = 16;
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+ParseStatus ChunkedDecoder::decode(std::string_view input,
+                                   std::size_t &consumed,
+                                   std::string_view &data) {
+  consumed = 0;
+  data = std::string_view();
+
+  while (consumed < input.size()) {
+    if (this->state == State::DONE)
+      return ParseStatus::COMPLETE;
+
+    if (this->state == State::DATA) {
+      // Handed out as it is, the framing around it is consumed by the next
+      // call
+      std::size_t available = input.size() - consumed;
+      std::size_t take =
+          this->remaining < available ? this->remaining : available;
+      data = input.substr(consumed, take);
+      consumed += take;
+      this->remaining -= take;
+      if (this->remaining == 0)
+        this->state = State::DATA_END;
+      return ParseStatus::INCOMPLETE;
+    }
+
+    char c = input[consumed++];
+    switch (this->state) {
+    case State::SIZE: {
+      int value = hex_value(c);
+      if (value >= 0) {
+        if (++this->digits > MAX_SIZE_DIGITS)
+          return ParseStatus::FAILED;
+        this->remaining = this->remaining * 16 + value;
+        break;
+      }
+      if (this->digits == 0)
+        return ParseStatus::FAILED;
+      this->state = State::SIZE_END;
+      this->line_bytes = 0;
+      this->saw_cr = false;
+      [[fallthrough]];
+    }
+    case State::SIZE_END: {
+      // Anything else behind the digits ("3x", "0x5") is a size another
+      // parser might read differently
+      if (++this->line_bytes > MAX_LINE_LENGTH)
+        return ParseStatus::FAILED;
+      if (!this->saw_cr && (c == ' ' || c == '\t'))
+        break;
+      if (!this->saw_cr && c == ';') {
+        this->state = State::EXTENSION;
+        break;
+      }
+      if (!this->saw_cr && c != '\r' && c != '\n')
+        return ParseStatus::FAILED;
+      [[fallthrough]];
+    }
+    case State::EXTENSION: {
+      int ended = this->line_end(c);
+      if (ended < 0 || ++this->line_bytes > MAX_LINE_LENGTH)
+        return ParseStatus::FAILED;
+      if (ended == 0)
+        break;
+      // A chunk of size 0 is the last one, the trailer section follows
+      this->state = this->remaining == 0 ? State::TRAILER : State::DATA;
+      this->saw_cr = false;
+      break;
+    }
+    case State::DATA_END: {
+      int ended = this->line_end(c);
+      if (ended < 0 || (ended == 0 && !this->saw_cr))
+        return ParseStatus::FAILED;
+      if (ended == 1) {
+        this->state = State::SIZE;
+        this->digits = 0;
+        this->saw_cr = false;
+      }
+      break;
+    }
+    case State::TRAILER: {
+      int ended = this->line_end(c);
+      if (ended == 1) {
+        // The empty line ends the body
+        this->state = State::DONE;
+        return ParseStatus::COMPLETE;
+      }
+      if (ended < 0)
+        return ParseStatus::FAILED;
+      if (ended == 0 && this->saw_cr)
+        break;
+      this->state = State::TRAILER_LINE;
+      this->line_bytes = 1;
+      break;
+    }
+    case State::TRAILER_LINE: {
+      int ended = this->line_end(c);
+      if (ended < 0 || ++this->line_bytes > MAX_LINE_LENGTH)
+        return ParseStatus::FAILED;
+      if (ended == 1) {
+        this->state = State::TRAILER;
+        this->saw_cr = false;
+      }
+      break;
+    }
+    case State::DATA:
+    case State::DONE:
+      break;
+    }
+  }
+  return this->state == State::DONE ? ParseStatus::COMPLETE
+                                    : ParseStatus::INCOMPLETE;
+}
+
+void ChunkedDecoder::reset() { *this = ChunkedDecoder(); }
+
+int ChunkedDecoder::line_end(char c) {
+  if (c == '\n') {
+    return 1;
+  }
+  if (this->saw_cr) {
+    return -1; // A CR not followed by LF
+  }
+  if (c == '\r') {
+    this->saw_cr = true;
+  }
+  return 0;
+}
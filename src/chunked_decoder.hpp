@@ -0,0 +1,56 @@
+#ifndef CHUNKED_DECODER_H
+#define CHUNKED_DECODER_H
+
+#include "request_parser.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/*
+ * Decodes a body sent with Transfer-Encoding: chunked while it arrives. The
+ * chunk data is handed out as views into the received bytes, so it can go
+ * straight to where the body is stored without being collected first. Chunk
+ * extensions and trailer fields are skipped.
+ */
+class ChunkedDecoder {
+public:
+  /*
+   * Continues decoding with the next received bytes
+   * @param input The received bytes the last call didn't consume
+   * @param consumed Set to the number of input bytes used up
+   * @param data Set to the body bytes that were decoded (a view into input),
+   * empty if the consumed bytes were only framing
+   * @return COMPLETE once the last chunk and the trailer section were read,
+   * FAILED if the framing is malformed
+   */
+  ParseStatus decode(std::string_view input, std::size_t &consumed,
+                     std::string_view &data);
+
+  void reset();
+
+private:
+  enum class State {
+    SIZE,      // The hex digits of the chunk size
+    SIZE_END,  // Whitespace behind the size, then ";" or the line end
+    EXTENSION, // The rest of the size line behind the ";"
+    DATA,
+    DATA_END,  // The CRLF behind the data
+    TRAILER,   // The start of a trailer line or the final empty line
+    TRAILER_LINE,
+    DONE
+  };
+
+  State state = State::SIZE;
+  uint64_t remaining = 0;     // Data bytes of the chunk still to come
+  std::size_t digits = 0;     // Hex digits of the chunk size so far
+  std::size_t line_bytes = 0; // Bytes of the extension or trailer line so far
+  bool saw_cr = false;        // The line ending of the state began already
+
+  /*
+   * Consumes a line ending (CRLF, a bare LF is tolerated)
+   * @return -1 if malformed, 1 once the line ended, 0 if more is needed
+   */
+  int line_end(char c);
+};
+
+#endif // !CHUNKED_DECODER_H
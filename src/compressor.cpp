@@ -0,0 +1,237 @@
+#include "compressor.hpp"
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Files waiting for a worker, later ones go out as they are until the queue
+// has room again
+const std::size_t MAX_QUEUED_JOBS = 256;
+// What an entry costs besides its path and variant
+const std::size_t ENTRY_OVERHEAD = 128;
+
+// The types that are text underneath, the others are mostly compressed
+// already (images, archives, media)
+bool compressible(std::string_view content_type) {
+  content_type = content_type.substr(0, content_type.find(';'));
+  if (content_type.substr(0, 5) == "text/")
+    return true;
+  if (content_type.ends_with("+xml") || content_type.ends_with("+json"))
+    return true;
+  return content_type == "application/javascript" ||
+         content_type == "application/json" ||
+         content_type == "application/xml" ||
+         content_type == "application/wasm";
+}
+
+bool gzip(std::string_view data, int level, std::string &out) {
+  if (data.size() > UINT_MAX)
+    return false;
+  z_stream stream = {};
+  // 16 added to the window bits writes a gzip header and trailer
+  if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out.resize(deflateBound(&stream, data.size()));
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef *>(out.data());
+  stream.avail_out = out.size();
+  int result = deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+
+#ifdef HAVE_ZSTD
+bool zstd(std::string_view data, int level, std::string &out) {
+  out.resize(ZSTD_compressBound(data.size()));
+  std::size_t size =
+      ZSTD_compress(out.data(), out.size(), data.data(), data.size(), level);
+  if (ZSTD_isError(size))
+    return false;
+  out.resize(size);
+  return true;
+}
+#endif
+
+bool compress_data(ContentCoding coding, std::string_view data, int level,
+                   std::string &out) {
+  switch (coding) {
+  case ContentCoding::GZIP:
+    return gzip(data, level, out);
+#ifdef HAVE_ZSTD
+  case ContentCoding::ZSTD:
+    return zstd(data, level, out);
+#endif
+  default:
+    return false;
+  }
+}
+
+std::size_t entry_cost(const std::string &path,
+                       const std::shared_ptr<const std::string> &variant) {
+  return ENTRY_OVERHEAD + path.size() + (variant ? variant->size() : 0);
+}
+
+Compressor::~Compressor() {
+  // The workers check the flag at least once a second, even if they miss
+  // the notification
+  this->stopping = true;
+  this->queued.notify_all();
+  for (std::thread &worker : this->workers) {
+    worker.join();
+  }
+}
+
+void Compressor::configure(unsigned int threads, int level,
+                           std::size_t min_size, std::size_t cache_size) {
+  this->level = level;
+  this->min_size = min_size;
+  this->budget = cache_size;
+  if (cache_size == 0 || !this->workers.empty())
+    return;
+
+  // The signals are handled by the event loops, the workers inherit the
+  // blocked mask
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &previous);
+  for (unsigned int i = 0; i < threads; ++i) {
+    this->workers.emplace_back(&Compressor::run, this);
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+bool Compressor::enabled() const { return !this->workers.empty(); }
+
+Siblings Compressor::codings(std::string_view content_type,
+                             std::size_t size) const {
+  Siblings codings;
+  if (!this->enabled() || size < this->min_size ||
+      !compressible(content_type)) {
+    return codings;
+  }
+  codings.exists[static_cast<std::size_t>(ContentCoding::GZIP)] = true;
+#ifdef HAVE_ZSTD
+  codings.exists[static_cast<std::size_t>(ContentCoding::ZSTD)] = true;
+#endif
+  return codings;
+}
+
+std::shared_ptr<const std::string>
+Compressor::find(std::string_view path, const struct timespec &mtime,
+                 std::size_t size, ContentCoding coding) {
+  auto &index = this->index[static_cast<std::size_t>(coding)];
+  std::lock_guard<std::mutex> lock(this->mutex);
+  auto found = index.find(path);
+  if (found == index.end())
+    return nullptr;
+  std::list<Entry>::iterator entry = found->second;
+  if (entry->mtime.tv_sec != mtime.tv_sec ||
+      entry->mtime.tv_nsec != mtime.tv_nsec || entry->size != size) {
+    return nullptr;
+  }
+  this->entries.splice(this->entries.begin(), this->entries, entry);
+  return entry->variant;
+}
+
+void Compressor::compress(std::string_view path,
+                          std::shared_ptr<const CachedFile> file,
+                          ContentCoding coding) {
+  auto &index = this->index[static_cast<std::size_t>(coding)];
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = index.find(path);
+    if (found != index.end()) {
+      std::list<Entry>::iterator entry = found->second;
+      if (entry->mtime.tv_sec == file->mtime.tv_sec &&
+          entry->mtime.tv_nsec == file->mtime.tv_nsec &&
+          entry->size == file->body.size()) {
+        return;
+      }
+      // The variant is of an older version of the file
+      this->erase(entry);
+    }
+    if (this->jobs.size() >= MAX_QUEUED_JOBS)
+      return;
+
+    // The entry stands for the queued job, so the file is queued only once
+    Entry entry;
+    entry.path = path;
+    entry.coding = coding;
+    entry.mtime = file->mtime;
+    entry.size = file->body.size();
+    this->entries.push_front(std::move(entry));
+    index[this->entries.front().path] = this->entries.begin();
+    this->used += entry_cost(this->entries.front().path, nullptr);
+    this->evict(this->entries.begin());
+
+    this->jobs.push_back(Job{std::string(path), coding, std::move(file)});
+  }
+  this->queued.notify_one();
+}
+
+void Compressor::run() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      while (!this->stopping && this->jobs.empty()) {
+        this->queued.wait_for(lock, std::chrono::seconds(1));
+      }
+      if (this->stopping)
+        return;
+      job = std::move(this->jobs.front());
+      this->jobs.pop_front();
+    }
+
+    std::string out;
+    bool compressed =
+        compress_data(job.coding, job.file->body, this->level, out) &&
+        out.size() < job.file->body.size();
+    std::shared_ptr<const std::string> variant;
+    if (compressed) {
+      out.shrink_to_fit();
+      variant = std::make_shared<const std::string>(std::move(out));
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto &index = this->index[static_cast<std::size_t>(job.coding)];
+    auto found = index.find(job.path);
+    if (found == index.end())
+      continue; // Evicted or replaced while it was compressed
+    std::list<Entry>::iterator entry = found->second;
+    if (entry->done || entry->mtime.tv_sec != job.file->mtime.tv_sec ||
+        entry->mtime.tv_nsec != job.file->mtime.tv_nsec ||
+        entry->size != job.file->body.size()) {
+      continue;
+    }
+    entry->done = true;
+    // A variant larger than the budget is remembered as not worth it
+    if (variant && entry_cost(entry->path, variant) <= this->budget) {
+      this->used += variant->size();
+      entry->variant = std::move(variant);
+    }
+    this->entries.splice(this->entries.begin(), this->entries, entry);
+    this->evict(entry);
+  }
+}
+
+void Compressor::evict(std::list<Entry>::iterator entry) {
+  while (this->used > this->budget &&
+         std::prev(this->entries.end()) != entry) {
+    this->erase(std::prev(this->entries.end()));
+  }
+}
+
+void Compressor::erase(std::list<Entry>::iterator entry) {
+  this->used -= entry_cost(entry->path, entry->variant);
+  this->index[static_cast<std::size_t>(entry->coding)].erase(entry->path);
+  this->entries.erase(entry);
+}
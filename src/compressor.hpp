@@ -0,0 +1,113 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include "content_coding.hpp"
+#include "file_cache.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <ctime>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Compresses cached files on the fly for the clients taking a coding the
+ * file has no precompressed sibling of. The compression runs on worker
+ * threads, never in an event loop: a file whose variant isn't there yet is
+ * queued and goes out as it is until the variant is ready. The variants are
+ * kept by path, mtime and coding, the least recently used ones are dropped
+ * once they outgrow their budget. A variant no smaller than its file is
+ * remembered as not worth it, so the file isn't compressed again.
+ */
+class Compressor {
+public:
+  Compressor() = default;
+  Compressor(const Compressor &) = delete;
+  Compressor &operator=(const Compressor &) = delete;
+  ~Compressor();
+
+  /*
+   * Starts the workers if compression is enabled
+   * @param threads The workers compressing files (0 = no compression)
+   * @param level From 1 (fastest) to 9 (smallest)
+   * @param min_size Smaller files aren't worth compressing
+   * @param cache_size The bytes all variants may take together
+   */
+  void configure(unsigned int threads, int level, std::size_t min_size,
+                 std::size_t cache_size);
+  bool enabled() const;
+
+  /*
+   * The codings a file can be compressed into, as siblings to choose from
+   * (their sizes aren't known yet), none if its type doesn't compress well
+   * or it is too small
+   */
+  Siblings codings(std::string_view content_type, std::size_t size) const;
+
+  /*
+   * The compressed variant of a file if it is ready
+   * @param path The normalized path of the file
+   * @param mtime The mtime of the file the variant has to be of
+   * @param size The size of the file the variant has to be of
+   * @return The variant or nullptr if there is none (yet)
+   */
+  std::shared_ptr<const std::string> find(std::string_view path,
+                                          const struct timespec &mtime,
+                                          std::size_t size,
+                                          ContentCoding coding);
+
+  /*
+   * Queues a cached file for compression unless its variant is ready,
+   * queued or known not to be worth it
+   */
+  void compress(std::string_view path, std::shared_ptr<const CachedFile> file,
+                ContentCoding coding);
+
+private:
+  struct Entry {
+    std::string path;
+    ContentCoding coding;
+    struct timespec mtime;
+    std::size_t size;
+    // nullptr while the file is queued or if compressing it didn't pay off
+    std::shared_ptr<const std::string> variant;
+    bool done = false;
+  };
+  struct Job {
+    std::string path;
+    ContentCoding coding;
+    std::shared_ptr<const CachedFile> file;
+  };
+
+  int level = 6;
+  std::size_t min_size = 0;
+  std::size_t budget = 0;
+
+  std::mutex mutex;
+  std::condition_variable queued;
+  std::deque<Job> jobs;
+  // The most recently used variants first, indexed by coding and path
+  std::list<Entry> entries;
+  std::unordered_map<std::string_view, std::list<Entry>::iterator>
+      index[CODING_COUNT];
+  std::size_t used = 0;
+
+  std::vector<std::thread> workers;
+  std::atomic<bool> stopping = false;
+
+  void run();
+  /*
+   * @param entry The entry of the job, the most recently used one
+   */
+  void evict(std::list<Entry>::iterator entry);
+  void erase(std::list<Entry>::iterator entry);
+};
+
+#endif // !COMPRESSOR_H
@@ -0,0 +1,54 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "arena.hpp"
+#include "chunked_decoder.hpp"
+#include "request.hpp"
+#include "request_parser.hpp"
+#include "recycler.hpp"
+#include "response.hpp"
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory_resource>
+#include <string>
+
+/*
+ * The states a client connection moves through inside the event loop
+ * READING    - collecting the bytes of the request
+ * PROCESSING - the complete requests get evaluated
+ * WRITING    - the responses are (partially) sent to the client
+ */
+enum class ConnectionState { READING, PROCESSING, WRITING };
+
+/*
+ * Everything the event loop has to remember about a single client between
+ * two readiness notifications
+ */
+struct Connection {
+  // Request-scoped memory, reset once no request is in flight. Declared
+  // first, so it outlives everything allocated from it.
+  Arena arena;
+  int socket = -1;
+  ConnectionState state = ConnectionState::READING;
+  std::string buffer; // The received bytes that were not consumed yet
+  Request request;    // The request that is currently received
+  RequestParser parser; // Parses the head of the next request
+  bool head_complete = false;
+  std::size_t body_remaining = 0; // Body bytes the request still waits for
+  bool chunked = false;           // The body comes with chunked framing
+  ChunkedDecoder decoder;
+  std::size_t body_received = 0; // Decoded bytes of a chunked body
+  // The responses that still have to be sent, in request order
+  std::pmr::deque<Response> responses{recycling_resource()};
+  std::size_t sent = 0;             // Bytes of the first one's data sent
+  bool keep_alive = false;          // Keep the connection after the response
+  bool peer_closed = false;         // The client shut down its sending side
+  unsigned int requests_served = 0; // Requests answered on this connection
+  // Requests holding a slot in the request queue of the admission control
+  unsigned int admitted_requests = 0;
+  // When the client was last heard from (for the idle timeout)
+  std::chrono::steady_clock::time_point last_activity;
+};
+
+#endif // !CONNECTION_H
@@ -0,0 +1,625 @@
+#include "connection_handler.hpp"
+#include "file_append.hpp"
+#include "http_date.hpp"
+#include "server.hpp"
+#include "string_utils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Responses queued on one connection before they are written out
+const std::size_t MAX_PIPELINE_DEPTH = 32;
+const std::size_t MAX_IOV = 128;
+// Files that aren't sent by the transport go through a buffer of this size
+const std::size_t STREAM_BLOCK_SIZE = 64 << 10;
+// Larger in-memory body buffers are freed instead of kept for the next request
+const std::size_t MAX_KEPT_BODY_CAPACITY = 16 << 10;
+// How long a shed client may take to read the 503 and hang up
+const std::chrono::milliseconds SHED_LINGER_TIME(1000);
+// Shed clients lingering at once, the oldest is closed beyond that
+const std::size_t MAX_SHED_CLIENTS = 256;
+
+// Reads and throws away what the client sent
+// @return False once the client hung up or the socket broke
+bool drain_socket(int client_socket) {
+  char buffer[4096];
+  // Bounded, a client that keeps sending is closed at its deadline anyway
+  for (int round = 0; round < 16; ++round) {
+    ssize_t result = recv(client_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (result == 0)
+      return false;
+  }
+  return true;
+}
+
+// Looks for a token in a comma-separated header value, ignoring the case
+bool has_token(std::string_view list, std::string_view token) {
+  while (!list.empty()) {
+    std::string_view::size_type comma = list.find(',');
+    std::string_view item = list.substr(0, comma);
+    while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+      item.remove_prefix(1);
+    while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+      item.remove_suffix(1);
+    if (iequals(item, token))
+      return true;
+    if (comma == std::string_view::npos)
+      break;
+    list.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+ConnectionHandler::ConnectionHandler(Server &server) : server(server) {}
+
+ConnectionHandler::~ConnectionHandler() {
+  for (const ShedClient &client : this->shed_clients) {
+    close(client.socket);
+  }
+}
+
+Task<> ConnectionHandler::serve(Transport &transport, Connection &conn) {
+  while (true) {
+    this->queue_responses(conn);
+
+    if (!conn.responses.empty()) {
+      bool sent = co_await this->send_responses(transport, conn);
+      // The answered requests leave the queue, one still being received
+      // keeps its slot
+      bool receiving = conn.head_complete || !conn.parser.idle();
+      unsigned int answered = conn.admitted_requests - (receiving ? 1 : 0);
+      Server::ADMISSION.release_requests(answered);
+      conn.admitted_requests -= answered;
+      if (!sent || !conn.keep_alive)
+        co_return;
+      // Nothing allocated for the answered requests is needed anymore
+      conn.arena.reset();
+      conn.state = ConnectionState::READING;
+      conn.last_activity = std::chrono::steady_clock::now();
+      continue; // More pipelined requests may be buffered already
+    }
+    if (conn.peer_closed)
+      co_return;
+
+    ssize_t received = co_await transport.receive(conn);
+    if (received < 0) {
+      std::cerr << "[ERROR] Failed to receive client request. errno: "
+                << -received << " (" << strerror(-received) << ")\n";
+      co_return;
+    }
+    if (received == 0) {
+      conn.peer_closed = true;
+    } else {
+      conn.last_activity = std::chrono::steady_clock::now();
+    }
+  }
+}
+
+Task<bool> ConnectionHandler::send_responses(Transport &transport,
+                                             Connection &conn) {
+  while (!conn.responses.empty()) {
+    Response &front = conn.responses.front();
+
+    // The header is out, the file follows
+    if (conn.sent == front.size() && front.has_file()) {
+      int result = front.transfer == FileTransfer::KERNEL
+                       ? co_await transport.send_file(conn, front)
+                       : co_await this->stream_file(transport, conn, front);
+      if (result < 0) {
+        // The file shrank or broke, the promised length can't be kept
+        std::cerr << "[ERROR] Failed to send the file. errno: " << -result
+                  << " (" << strerror(-result) << ")\n";
+        co_return false;
+      }
+      continue;
+    }
+    if (conn.sent == front.size()) {
+      conn.responses.pop_front();
+      conn.sent = 0;
+      continue;
+    }
+
+    // Gather the segments of the queued responses into a single send, up to
+    // the first response that continues with a file
+    iovec iov[MAX_IOV];
+    std::size_t count = 0;
+    bool first = true;
+    for (const Response &response : conn.responses) {
+      if (count == MAX_IOV)
+        break;
+      // Sending from a truncated mapping would fault, a file changed
+      // outside the server can't be sent with the promised length anyway
+      if (!response.body_intact()) {
+        std::cerr << "[ERROR] The mapped file shrank while it was sent\n";
+        co_return false;
+      }
+      std::size_t offset = first ? conn.sent : 0;
+      first = false;
+      count += response.gather(iov + count, MAX_IOV - count, offset);
+      if (response.has_file())
+        break;
+    }
+
+    ssize_t sent = co_await transport.send(conn, iov, count);
+    if (sent < 0) {
+      std::cerr << "[ERROR] Failed to send the response. errno: " << -sent
+                << " (" << strerror(-sent) << ")\n";
+      co_return false;
+    }
+
+    // Drop the responses that are completely out
+    std::size_t remaining = sent;
+    while (remaining > 0) {
+      Response &response = conn.responses.front();
+      std::size_t left = response.size() - conn.sent;
+      if (remaining < left || response.has_file()) {
+        conn.sent += std::min(remaining, left);
+        break;
+      }
+      remaining -= left;
+      conn.responses.pop_front();
+      conn.sent = 0;
+    }
+  }
+  co_return true;
+}
+
+Task<int> ConnectionHandler::stream_file(Transport &transport,
+                                         Connection &conn,
+                                         Response &response) {
+  // One block per streamed file, no matter how large the file is
+  std::unique_ptr<char[]> block(new char[STREAM_BLOCK_SIZE]);
+  bool sized = response.transfer == FileTransfer::BLOCKS;
+  bool chunked = response.transfer == FileTransfer::CHUNKED;
+
+  while (!sized || response.file_length > 0) {
+    std::size_t length = STREAM_BLOCK_SIZE;
+    if (sized)
+      length = std::min(length, response.file_length);
+    // A pipe or device is read once it has data, a slow writer doesn't
+    // stall the other connections of the loop
+    ssize_t result;
+    if (sized) {
+      result = pread(response.file_fd, block.get(), length,
+                     response.file_offset);
+      if (result < 0 && errno == EINTR)
+        continue;
+      if (result < 0) {
+        int error = errno;
+        co_return -error;
+      }
+    } else {
+      result = co_await transport.read_file(conn, response.file_fd,
+                                            block.get(), length);
+      if (result < 0)
+        co_return result;
+    }
+    if (result == 0) {
+      if (sized)
+        co_return -EIO; // The file shrank
+      break;
+    }
+    response.file_offset += result;
+    if (sized)
+      response.file_length -= result;
+
+    // A chunk is its size in hex, the data and CRLF
+    char size_line[24];
+    iovec iov[3];
+    std::size_t count = 0;
+    if (chunked) {
+      int size_length =
+          snprintf(size_line, sizeof(size_line), "%zx\r\n",
+                   static_cast<std::size_t>(result));
+      iov[count++] = {size_line, static_cast<std::size_t>(size_length)};
+    }
+    iov[count++] = {block.get(), static_cast<std::size_t>(result)};
+    if (chunked)
+      iov[count++] = {const_cast<char *>("\r\n"), 2};
+    int sent = co_await this->send_all(transport, conn, iov, count);
+    if (sent < 0)
+      co_return sent;
+  }
+
+  if (chunked) {
+    // The last chunk, without trailers
+    iovec last = {const_cast<char *>("0\r\n\r\n"), 5};
+    int sent = co_await this->send_all(transport, conn, &last, 1);
+    if (sent < 0)
+      co_return sent;
+  }
+  response.close_file();
+  co_return 0;
+}
+
+Task<int> ConnectionHandler::send_all(Transport &transport, Connection &conn,
+                                      iovec *iov, std::size_t count) {
+  // Each send only returns once the socket took something, a slow client
+  // holds the stream back instead of letting blocks pile up
+  while (count > 0) {
+    ssize_t sent = co_await transport.send(conn, iov, count);
+    if (sent < 0)
+      co_return sent;
+    std::size_t remaining = sent;
+    while (count > 0 && remaining >= iov->iov_len) {
+      remaining -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + remaining;
+      iov->iov_len -= remaining;
+    }
+  }
+  co_return 0;
+}
+
+bool ConnectionHandler::admit(int client_socket) {
+  if (Server::ADMISSION.admit_connection())
+    return true;
+
+  // A fresh socket takes the few bytes without blocking
+  const std::string &response = Server::ADMISSION.overload_response();
+  send(client_socket, response.data(), response.size(),
+       MSG_NOSIGNAL | MSG_DONTWAIT);
+  shutdown(client_socket, SHUT_WR);
+  if (!drain_socket(client_socket)) {
+    close(client_socket);
+    return false;
+  }
+
+  if (this->shed_clients.size() >= MAX_SHED_CLIENTS) {
+    close(this->shed_clients.front().socket);
+    this->shed_clients.pop_front();
+  }
+  this->shed_clients.push_back(
+      {client_socket, std::chrono::steady_clock::now() + SHED_LINGER_TIME});
+  return false;
+}
+
+void ConnectionHandler::close_shed_clients() {
+  auto now = std::chrono::steady_clock::now();
+  std::erase_if(this->shed_clients, [now](const ShedClient &client) {
+    if (now < client.deadline && drain_socket(client.socket))
+      return false;
+    close(client.socket);
+    return true;
+  });
+}
+
+bool ConnectionHandler::has_shed_clients() const {
+  return !this->shed_clients.empty();
+}
+
+void ConnectionHandler::release(Connection &conn) {
+  this->discard_request(conn);
+  Server::ADMISSION.release_requests(conn.admitted_requests);
+  conn.admitted_requests = 0;
+  Server::ADMISSION.release_connection();
+}
+
+void ConnectionHandler::queue_responses(Connection &conn) {
+  // Answer every complete request in the buffer, the responses are queued in
+  // request order and leave together
+  bool close_after = false;
+  while (!close_after && conn.responses.size() < MAX_PIPELINE_DEPTH) {
+    unsigned int error_status = 0;
+    bool complete = this->receive_request(conn, error_status);
+
+    if (error_status == 503) {
+      // Shed without looking at the request, the response is complete
+      this->discard_request(conn);
+      conn.responses.push_back(
+          Response::prerendered(Server::ADMISSION.overload_response()));
+      close_after = true;
+      break;
+    }
+    if (error_status != 0) {
+      std::cerr << "[ERROR] Rejecting the client request with "
+                << error_status << "\n";
+      this->discard_request(conn);
+      Response response =
+          this->server.generate_response(&conn.arena, error_status);
+      response.add_header("Date", current_http_date());
+      this->add_connection_header(response, false, 0);
+      conn.responses.push_back(std::move(response));
+      close_after = true;
+      break;
+    }
+    if (!complete)
+      break;
+
+    conn.state = ConnectionState::PROCESSING;
+    ++conn.requests_served;
+    unsigned int max_requests = this->server.config.max_requests;
+    bool keep_alive = conn.requests_served < max_requests &&
+                      this->wants_keep_alive(conn.request.view);
+    close_after = !keep_alive;
+
+    Response response;
+    bool failed = false;
+    try {
+      response = this->server.evaluate_request(conn.request);
+    } catch (const std::exception &error) {
+      std::cerr << "[ERROR] Failed to handle the request: " << error.what()
+                << "\n";
+      failed = true;
+    } catch (...) {
+      std::cerr << "[ERROR] Failed to handle the request\n";
+      failed = true;
+    }
+    if (failed) {
+      // Nothing is known about the state the handler left, the client gets
+      // a 500 and the connection ends
+      response = this->server.generate_response(&conn.arena, 500);
+      keep_alive = false;
+      close_after = true;
+    }
+    this->discard_request(conn);
+    // The end of the connection is the end of the body
+    if (response.transfer == FileTransfer::UNTIL_CLOSE) {
+      keep_alive = false;
+      close_after = true;
+    }
+    response.add_header("Date", current_http_date());
+    this->add_connection_header(response, keep_alive,
+                                max_requests - conn.requests_served);
+    conn.responses.push_back(std::move(response));
+  }
+
+  if (conn.responses.empty()) {
+    conn.state = ConnectionState::READING;
+    return;
+  }
+
+  conn.keep_alive = !close_after && !conn.peer_closed;
+  if (close_after)
+    conn.buffer.clear();
+  conn.state = ConnectionState::WRITING;
+}
+
+void ConnectionHandler::add_connection_header(Response &response,
+                                              bool keep_alive,
+                                              unsigned int remaining) {
+  if (!keep_alive) {
+    response.add_header("Connection", "close");
+    return;
+  }
+
+  char value[64];
+  int length = snprintf(value, sizeof(value), "timeout=%d, max=%u",
+                        this->server.config.keep_alive_timeout, remaining);
+  response.add_header("Connection", "keep-alive");
+  response.add_header("Keep-Alive", std::string_view(value, length));
+}
+
+bool ConnectionHandler::wants_keep_alive(const RequestView &request) {
+  bool http_1_0 = request.version == "HTTP/1.0";
+
+  std::optional<std::string_view> value =
+      request.header(KnownHeader::CONNECTION);
+  if (!value)
+    return !http_1_0; // Persistent by default since HTTP/1.1
+
+  if (has_token(*value, "close"))
+    return false;
+  if (has_token(*value, "keep-alive"))
+    return true;
+  return !http_1_0;
+}
+
+bool ConnectionHandler::receive_request(Connection &conn,
+                                        unsigned int &error_status) {
+  const ServerConfig &config = this->server.config;
+
+  if (!conn.head_complete) {
+    if (conn.parser.idle()) {
+      if (conn.buffer.empty())
+        return false;
+      // Shed overload before the request is parsed or touches a file
+      if (!Server::ADMISSION.admit_request()) {
+        error_status = 503;
+        return false;
+      }
+      ++conn.admitted_requests;
+    }
+
+    // Continues where the last call stopped
+    ParseStatus parsed = conn.parser.parse(conn.buffer);
+    if (parsed == ParseStatus::FAILED) {
+      error_status = conn.parser.error_status();
+      return false;
+    }
+    if (parsed == ParseStatus::INCOMPLETE) {
+      if (conn.buffer.size() > config.max_header_size)
+        error_status = 431;
+      return false;
+    }
+    std::size_t head_size = conn.parser.head_size();
+    if (head_size > config.max_header_size) {
+      error_status = 431;
+      return false;
+    }
+
+    conn.request.memory = &conn.arena;
+    conn.request.head.assign(conn.buffer, 0, head_size);
+    conn.buffer.erase(0, head_size);
+    conn.parser.view(conn.request.head, conn.request.view);
+    conn.parser.reset();
+    const RequestView &view = conn.request.view;
+
+    std::optional<std::size_t> length;
+    if (!find_content_length(view, length)) {
+      error_status = 400;
+      return false;
+    }
+    std::size_t content_length = length.value_or(0);
+
+    std::optional<std::string_view> encoding =
+        view.header(KnownHeader::TRANSFER_ENCODING);
+    if (encoding) {
+      // Both framings at once is how requests get smuggled
+      if (length) {
+        error_status = 400;
+        return false;
+      }
+      // No other transfer coding is understood
+      if (!iequals(*encoding, "chunked")) {
+        error_status = 501;
+        return false;
+      }
+      conn.chunked = true;
+    }
+
+    std::size_t max_body_size = config.max_body_size;
+    if (max_body_size != 0 && content_length > max_body_size) {
+      error_status = 413;
+      return false;
+    }
+    if (content_length > config.body_spool_threshold &&
+        !this->open_spool(conn)) {
+      error_status = 500;
+      return false;
+    }
+
+    // The client waits for the go before it sends a large body
+    std::optional<std::string_view> expect =
+        view.header(KnownHeader::EXPECT);
+    bool body_pending = conn.chunked ? conn.buffer.empty()
+                                     : content_length > conn.buffer.size();
+    if (expect && body_pending && iequals(*expect, "100-continue")) {
+      conn.responses.push_back(
+          Response::prerendered("HTTP/1.1 100 Continue\r\n\r\n"));
+    }
+
+    conn.head_complete = true;
+    conn.body_remaining = content_length;
+  }
+
+  if (conn.chunked) {
+    if (!this->receive_chunked(conn, error_status))
+      return false;
+  } else {
+    std::size_t take = std::min(conn.body_remaining, conn.buffer.size());
+    if (take > 0) {
+      std::string_view bytes(conn.buffer.data(), take);
+      if (!this->append_body(conn, bytes)) {
+        error_status = 500;
+        return false;
+      }
+      conn.buffer.erase(0, take);
+      conn.body_remaining -= take;
+    }
+    if (conn.body_remaining > 0)
+      return false;
+  }
+
+  conn.head_complete = false;
+  conn.chunked = false;
+  return true;
+}
+
+bool ConnectionHandler::receive_chunked(Connection &conn,
+                                        unsigned int &error_status) {
+  std::size_t max_body_size = this->server.config.max_body_size;
+  std::string_view input = conn.buffer;
+  std::size_t offset = 0;
+  ParseStatus status = ParseStatus::INCOMPLETE;
+
+  while (offset < input.size() && status == ParseStatus::INCOMPLETE) {
+    std::size_t consumed = 0;
+    std::string_view data;
+    status = conn.decoder.decode(input.substr(offset), consumed, data);
+    if (status == ParseStatus::FAILED) {
+      error_status = 400;
+      return false;
+    }
+    offset += consumed;
+    if (data.empty())
+      continue;
+
+    conn.body_received += data.size();
+    if (max_body_size != 0 && conn.body_received > max_body_size) {
+      error_status = 413;
+      return false;
+    }
+    if (!this->append_body(conn, data)) {
+      error_status = 500;
+      return false;
+    }
+  }
+
+  // Only the bytes behind the body stay, they belong to the next request
+  conn.buffer.erase(0, offset);
+  return status == ParseStatus::COMPLETE;
+}
+
+bool ConnectionHandler::append_body(Connection &conn, std::string_view bytes) {
+  if (conn.request.body_fd < 0 && conn.request.body.size() + bytes.size() >
+                              this->server.config.body_spool_threshold) {
+    // The body outgrew the memory, what arrived so far moves to the file
+    if (!this->open_spool(conn) ||
+        !this->append_body(conn, conn.request.body))
+      return false;
+    conn.request.body.clear();
+  }
+
+  if (conn.request.body_fd < 0) {
+    conn.request.body.append(bytes);
+    return true;
+  }
+
+  if (!write_all(conn.request.body_fd, bytes)) {
+    std::cerr << "[ERROR] Failed to spool the request body. errno: " << errno
+              << " (" << strerror(errno) << ")\n";
+    return false;
+  }
+  return true;
+}
+bool ConnectionHandler::open_spool(Connection &conn) {
+  // Without a name it can't be requested, isn't reported by the watcher and
+  // doesn't outlive a crash. It's linked into place if it becomes the file.
+  conn.request.body_fd = open_temp_file(".");
+  if (conn.request.body_fd < 0) {
+    std::cerr << "[ERROR] Failed to create a spool file. errno: " << errno
+              << " (" << strerror(errno) << ")\n";
+    return false;
+  }
+  return true;
+}
+
+void ConnectionHandler::discard_request(Connection &conn) {
+  // A handler that kept the body linked the spool file already
+  if (conn.request.body_fd >= 0) {
+    close(conn.request.body_fd);
+    conn.request.body_fd = -1;
+  }
+  // The buffers keep their capacity for the next request
+  conn.request.head.clear();
+  conn.request.view = RequestView();
+  conn.request.body.clear();
+  if (conn.request.body.capacity() > MAX_KEPT_BODY_CAPACITY)
+    conn.request.body = std::string();
+  conn.parser.reset();
+  conn.head_complete = false;
+  conn.body_remaining = 0;
+  conn.chunked = false;
+  conn.decoder.reset();
+  conn.body_received = 0;
+}
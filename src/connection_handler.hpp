@@ -0,0 +1,133 @@
+#ifndef CONNECTION_HANDLER_H
+#define CONNECTION_HANDLER_H
+
+#include "connection.hpp"
+#include "task.hpp"
+#include "transport.hpp"
+#include <chrono>
+#include <deque>
+#include <string>
+#include <string_view>
+
+class Server;
+
+/*
+ * The HTTP side of a connection: turns received bytes into requests and
+ * queues their responses. The event loop backends only move bytes, the
+ * lifecycle of a connection is a coroutine awaiting their operations.
+ */
+class ConnectionHandler {
+public:
+  ConnectionHandler(Server &server);
+  ConnectionHandler(const ConnectionHandler &) = delete;
+  ConnectionHandler &operator=(const ConnectionHandler &) = delete;
+  ~ConnectionHandler();
+
+  /*
+   * Serves a client from its first request until the connection ends: reads
+   * requests, answers them and keeps the connection alive as negotiated.
+   * Returns when the client should be disconnected.
+   * @param transport The backend the socket operations are awaited on
+   * @param conn The connection of the client
+   */
+  Task<> serve(Transport &transport, Connection &conn);
+
+  /*
+   * Takes a connection slot for a new client. Without a free slot the client
+   * gets the pre-rendered 503 and its socket lingers as a shed client.
+   * @return True if the client may be served
+   */
+  bool admit(int client_socket);
+
+  /*
+   * Drains the shed clients and closes their sockets once they hung up or
+   * their linger time ran out. Called regularly by the event loop.
+   */
+  void close_shed_clients();
+  bool has_shed_clients() const;
+
+  /*
+   * Gives back what a connection that ends holds: the request that is
+   * currently received, its request slots and its connection slot
+   */
+  void release(Connection &conn);
+
+  /*
+   * Answers every complete request in the buffer of the connection and queues
+   * the responses in request order. Afterwards the connection is WRITING if
+   * responses are queued and READING otherwise.
+   * @param conn The connection whose buffer holds the received bytes
+   */
+  void queue_responses(Connection &conn);
+
+  /*
+   * Throws away the request that is currently received (and its spool file)
+   */
+  void discard_request(Connection &conn);
+
+private:
+  /*
+   * A client that got the 503. Its socket is only shut down for writing: a
+   * close with its request still unread would reset the connection and the
+   * client could lose the 503.
+   */
+  struct ShedClient {
+    int socket;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  Server &server;
+  std::deque<ShedClient> shed_clients;
+  /*
+   * Sends the queued responses, gathering as many as possible into one send
+   * @return False if the connection broke
+   */
+  Task<bool> send_responses(Transport &transport, Connection &conn);
+  /*
+   * Sends the file of a response the transport doesn't send itself, read
+   * block by block into a single buffer and in chunked coding if the
+   * response asks for it. Each block is sent before the next one is read.
+   * @return 0 or -errno
+   */
+  Task<int> stream_file(Transport &transport, Connection &conn,
+                        Response &response);
+  /*
+   * Sends the buffers completely, adjusting them after partial sends
+   * @return 0 or -errno
+   */
+  Task<int> send_all(Transport &transport, Connection &conn, iovec *iov,
+                     std::size_t count);
+  /*
+   * Moves the buffered bytes into the request that is currently received.
+   * Headers are collected up to the configured limit, then exactly
+   * Content-Length body bytes are read (into a spool file for large bodies).
+   * @param error_status Set to the status to reject the request with
+   * @return True if the request is complete
+   */
+  bool receive_request(Connection &conn, unsigned int &error_status);
+  bool open_spool(Connection &conn);
+  /*
+   * Stores received body bytes in memory or, once the body outgrows the
+   * spool threshold, in the spool file
+   * @return False if the spool file can't be written
+   */
+  bool append_body(Connection &conn, std::string_view bytes);
+  /*
+   * Feeds the buffered bytes of a chunked body to the decoder
+   * @return True once the body is complete
+   */
+  bool receive_chunked(Connection &conn, unsigned int &error_status);
+  /*
+   * Adds the Connection (and Keep-Alive) header
+   * @param remaining The requests still allowed over the connection
+   */
+  void add_connection_header(Response &response, bool keep_alive,
+                             unsigned int remaining);
+  /*
+   * Decides on the request line and the Connection header if the client wants
+   * a persistent connection
+   */
+  bool wants_keep_alive(const RequestView &request);
+};
+
+#endif // !CONNECTION_HANDLER_H
@@ -0,0 +1,117 @@
+#include "content_coding.hpp"
+#include "string_utils.hpp"
+
+const std::string_view CODING_NAMES[CODING_COUNT] = {"identity", "gzip", "br",
+                                                     "zstd"};
+const std::string_view CODING_SUFFIXES[CODING_COUNT] = {"", ".gz", ".br",
+                                                        ".zst"};
+// Qualities are compared in thousandths, "q=1" is the default
+const unsigned int MAX_QUALITY = 1000;
+
+std::string_view coding_name(ContentCoding coding) {
+  return CODING_NAMES[static_cast<std::size_t>(coding)];
+}
+
+std::string_view coding_suffix(ContentCoding coding) {
+  return CODING_SUFFIXES[static_cast<std::size_t>(coding)];
+}
+
+bool Siblings::any() const {
+  for (std::size_t i = 1; i < CODING_COUNT; ++i) {
+    if (this->exists[i])
+      return true;
+  }
+  return false;
+}
+
+std::string_view trim_whitespace(std::string_view value) {
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+    value.remove_prefix(1);
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+    value.remove_suffix(1);
+  return value;
+}
+
+// A qvalue ("0", "0.5", "1.000") in thousandths, a malformed one makes the
+// coding unacceptable
+unsigned int parse_quality(std::string_view value) {
+  if (value.empty() || (value[0] != '0' && value[0] != '1'))
+    return 0;
+  unsigned int quality = (value[0] - '0') * MAX_QUALITY;
+  if (value.size() == 1)
+    return quality;
+  if (value[1] != '.' || value.size() > 5)
+    return 0;
+  unsigned int scale = MAX_QUALITY / 10;
+  for (char c : value.substr(2)) {
+    if (c < '0' || c > '9')
+      return 0;
+    quality += (c - '0') * scale;
+    scale /= 10;
+  }
+  return quality > MAX_QUALITY ? 0 : quality;
+}
+
+ContentCoding choose_coding(std::optional<std::string_view> accept_encoding,
+                            const Siblings &siblings) {
+  if (!accept_encoding || !siblings.any())
+    return ContentCoding::IDENTITY;
+
+  unsigned int quality[CODING_COUNT] = {};
+  bool listed[CODING_COUNT] = {};
+  std::optional<unsigned int> wildcard;
+
+  std::string_view list = *accept_encoding;
+  while (!list.empty()) {
+    std::string_view::size_type comma = list.find(',');
+    std::string_view item = list.substr(0, comma);
+    list = comma == std::string_view::npos ? std::string_view()
+                                           : list.substr(comma + 1);
+
+    // coding *( OWS ";" OWS "q=" qvalue )
+    std::string_view::size_type semicolon = item.find(';');
+    std::string_view name = trim_whitespace(item.substr(0, semicolon));
+    unsigned int item_quality = MAX_QUALITY;
+    if (semicolon != std::string_view::npos) {
+      std::string_view parameter = trim_whitespace(item.substr(semicolon + 1));
+      if (parameter.size() >= 2 &&
+          (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=') {
+        item_quality = parse_quality(parameter.substr(2));
+      }
+    }
+
+    // x-gzip is the old name of gzip
+    if (iequals(name, "x-gzip"))
+      name = "gzip";
+    if (name == "*") {
+      wildcard = item_quality;
+      continue;
+    }
+    for (std::size_t i = 0; i < CODING_COUNT; ++i) {
+      if (iequals(name, CODING_NAMES[i])) {
+        quality[i] = item_quality;
+        listed[i] = true;
+      }
+    }
+  }
+
+  // Unlisted codings get the wildcard. Without one the identity is still
+  // acceptable, but any listed coding is preferred to it.
+  for (std::size_t i = 0; i < CODING_COUNT; ++i) {
+    if (!listed[i])
+      quality[i] = wildcard ? *wildcard : (i == 0 ? 1 : 0);
+  }
+
+  std::size_t best = 0;
+  for (std::size_t i = 1; i < CODING_COUNT; ++i) {
+    if (!siblings.exists[i] || quality[i] == 0)
+      continue;
+    if (best == 0 ? quality[i] >= quality[0]
+                  : quality[i] > quality[best] ||
+                        (quality[i] == quality[best] &&
+                         siblings.size[i] < siblings.size[best])) {
+      best = i;
+    }
+  }
+  return static_cast<ContentCoding>(best);
+}
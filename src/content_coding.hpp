@@ -0,0 +1,56 @@
+#ifndef CONTENT_CODING_H
+#define CONTENT_CODING_H
+
+#include <cstddef>
+#include <ctime>
+#include <optional>
+#include <string_view>
+
+/*
+ * The content codings a file can be sent in, the compressed ones come from
+ * precompressed siblings next to the file or are compressed on the fly
+ */
+enum class ContentCoding : unsigned int {
+  IDENTITY,
+  GZIP,
+  BROTLI,
+  ZSTD,
+  COUNT
+};
+
+const std::size_t CODING_COUNT = static_cast<std::size_t>(ContentCoding::COUNT);
+
+/*
+ * The name of the coding in Accept-Encoding and Content-Encoding
+ */
+std::string_view coding_name(ContentCoding coding);
+
+/*
+ * What the precompressed sibling of a file appends to its name ("" for
+ * the identity)
+ */
+std::string_view coding_suffix(ContentCoding coding);
+
+/*
+ * The precompressed siblings of a file (file.gz, file.br and file.zst) as
+ * they were found, indexed by their coding
+ */
+struct Siblings {
+  bool exists[CODING_COUNT] = {};
+  std::size_t size[CODING_COUNT] = {};
+  std::time_t mtime[CODING_COUNT] = {};
+
+  bool any() const;
+};
+
+/*
+ * Picks the coding to send a file in: the highest quality the client gives
+ * to a coding the file has, ties go to the smaller sibling and the
+ * compressed siblings win over the identity.
+ * @param accept_encoding The Accept-Encoding header of the request, without
+ * it the file is sent as it is
+ */
+ContentCoding choose_coding(std::optional<std::string_view> accept_encoding,
+                            const Siblings &siblings);
+
+#endif // !CONTENT_CODING_H
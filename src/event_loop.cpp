@@ -0,0 +1,351 @@
+#include "event_loop.hpp"
+#include "http_date.hpp"
+#include "server.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <utility>
+
+// Bytes received from a socket at once
+const std::size_t RECEIVE_SIZE = 16 << 10;
+const int MAX_EVENTS = 128;
+const int IDLE_CHECK_INTERVAL_MS = 1000;
+
+EventLoop::EventLoop(Server &server, int listen_socket)
+    : server(server), handler(server), listen_socket(listen_socket),
+      receive_buffer(RECEIVE_SIZE) {
+  this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (this->epoll_fd < 0) {
+    std::cerr << "[ERROR] Creation of the epoll instance failed. errno: "
+              << errno << " (" << strerror(errno) << ")\n";
+    throw "[SERVER] Failed to create the event loop\n";
+  }
+
+  this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->wake_fd < 0) {
+    std::cerr << "[ERROR] Creation of the wakeup eventfd failed. errno: "
+              << errno << " (" << strerror(errno) << ")\n";
+    close(this->epoll_fd);
+    throw "[SERVER] Failed to create the event loop\n";
+  }
+
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLET;
+  event.data.fd = this->wake_fd;
+  epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->wake_fd, &event);
+  // Nobody reads the stop eventfd, it stays readable for every loop
+  event.data.fd = this->server.stop_fd;
+  epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->server.stop_fd, &event);
+
+  if (this->listen_socket < 0)
+    return;
+
+  event.data.fd = this->listen_socket;
+  if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->listen_socket, &event) <
+      0) {
+    std::cerr << "[ERROR] Registering the server socket failed. errno: "
+              << errno << " (" << strerror(errno) << ")\n";
+    close(this->wake_fd);
+    close(this->epoll_fd);
+    throw "[SERVER] Failed to register the server socket\n";
+  }
+}
+
+EventLoop::~EventLoop() {
+  for (auto &entry : this->sessions) {
+    this->handler.release(entry.second.conn);
+    close(entry.first);
+  }
+  for (int client_socket : this->adopted) {
+    close(client_socket);
+  }
+  close(this->wake_fd);
+  close(this->epoll_fd);
+}
+
+void EventLoop::adopt(int client_socket) {
+  {
+    std::lock_guard<std::mutex> lock(this->adopted_mutex);
+    this->adopted.push_back(client_socket);
+  }
+  uint64_t one = 1;
+  if (write(this->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    std::cerr << "[ERROR] Failed to wake up the event loop. errno: " << errno
+              << " (" << strerror(errno) << ")\n";
+  }
+}
+
+void EventLoop::register_adopted() {
+  uint64_t count;
+  while (read(this->wake_fd, &count, sizeof(count)) > 0) {
+  }
+
+  std::vector<int> clients;
+  {
+    std::lock_guard<std::mutex> lock(this->adopted_mutex);
+    clients.swap(this->adopted);
+  }
+  for (int client_socket : clients) {
+    this->add_connection(client_socket);
+  }
+}
+
+bool EventLoop::add_connection(int client_socket) {
+  if (!this->handler.admit(client_socket))
+    return false;
+
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.fd = client_socket;
+  if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+    std::cerr << "[ERROR] Failed to register client socket. errno: " << errno
+              << " (" << strerror(errno) << ")\n";
+    close(client_socket);
+    this->server.ADMISSION.release_connection();
+    return false;
+  }
+
+  Session &session = this->sessions[client_socket];
+  session.conn.socket = client_socket;
+  session.conn.last_activity = std::chrono::steady_clock::now();
+  session.task = this->serve(session.conn);
+  session.task.start();
+  return true;
+}
+
+Task<> EventLoop::serve(Connection &conn) {
+  // Nothing awaits the task, an exception would end it unnoticed and leave
+  // the connection open forever
+  try {
+    co_await this->handler.serve(*this, conn);
+  } catch (const std::exception &error) {
+    std::cerr << "[ERROR] Serving the client failed: " << error.what()
+              << "\n";
+  } catch (...) {
+    std::cerr << "[ERROR] Serving the client failed\n";
+  }
+  this->finished.push_back(conn.socket);
+}
+
+void EventLoop::run() {
+  epoll_event events[MAX_EVENTS];
+  while (true) {
+    // Wake up regularly while there are connections that could become idle
+    int timeout =
+        this->sessions.empty() && !this->handler.has_shed_clients()
+            ? -1
+            : IDLE_CHECK_INTERVAL_MS;
+    int ready = epoll_wait(this->epoll_fd, events, MAX_EVENTS, timeout);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "[ERROR] Waiting for events failed. errno: " << errno
+                << " (" << strerror(errno) << ")\n";
+      return;
+    }
+    refresh_http_date();
+
+    for (int i = 0; i < ready; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == this->listen_socket) {
+        this->accept_connections();
+      } else if (fd == this->wake_fd) {
+        this->register_adopted();
+      } else if (fd == this->server.stop_fd) {
+        return; // The open connections are closed with the loop
+      } else {
+        // A file a session waits to read from wakes the session up
+        auto reader = this->file_readers.find(fd);
+        auto it = this->sessions.find(
+            reader == this->file_readers.end() ? fd : reader->second);
+        if (it == this->sessions.end() || !it->second.waiter)
+          continue;
+        // Errors and hang-ups resume it as well, the retried operation
+        // reports them
+        std::exchange(it->second.waiter, nullptr).resume();
+      }
+      this->close_finished();
+    }
+
+    this->close_idle_connections();
+  }
+}
+
+/*
+ * Never ready right away: the operation that would have blocked was tried
+ * already, the coroutine continues once the next edge arrives
+ */
+struct EventLoop::Readiness {
+  Session &session;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) noexcept {
+    this->session.waiter = handle;
+  }
+  void await_resume() const noexcept {}
+};
+
+EventLoop::Readiness EventLoop::wait_ready(Connection &conn) {
+  return Readiness{this->sessions.at(conn.socket)};
+}
+
+Task<ssize_t> EventLoop::receive(Connection &conn) {
+  while (true) {
+    // The loop runs one coroutine at a time, so they share the buffer
+    ssize_t received = recv(conn.socket, this->receive_buffer.data(),
+                            this->receive_buffer.size(), 0);
+    if (received >= 0) {
+      conn.buffer.append(this->receive_buffer.data(), received);
+      co_return received;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      co_return -errno;
+    co_await this->wait_ready(conn);
+  }
+}
+
+Task<ssize_t> EventLoop::send(Connection &conn, const iovec *iov,
+                              std::size_t count) {
+  msghdr message{};
+  message.msg_iov = const_cast<iovec *>(iov);
+  message.msg_iovlen = count;
+  while (true) {
+    ssize_t sent = sendmsg(conn.socket, &message, MSG_NOSIGNAL);
+    if (sent >= 0)
+      co_return sent;
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      co_return -errno;
+    co_await this->wait_ready(conn);
+  }
+}
+
+Task<int> EventLoop::send_file(Connection &conn, Response &response) {
+  // Let the kernel move the file to the socket
+  while (response.file_length > 0) {
+    ssize_t sent = sendfile(conn.socket, response.file_fd,
+                            &response.file_offset, response.file_length);
+    if (sent > 0) {
+      response.file_length -= sent;
+      continue;
+    }
+    if (sent == 0)
+      co_return -EIO; // The file shrank
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      co_await this->wait_ready(conn);
+      continue;
+    }
+    if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+      // Not usable for this file, it is read and sent block by block
+      response.transfer = FileTransfer::BLOCKS;
+      co_return 0;
+    }
+    co_return -errno;
+  }
+  co_return 0;
+}
+
+Task<ssize_t> EventLoop::read_file(Connection &conn, int fd, char *buffer,
+                                   std::size_t length) {
+  while (true) {
+    ssize_t result = read(fd, buffer, length);
+    if (result >= 0)
+      co_return result;
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      co_return -errno;
+
+    // The file is watched only while the session waits for it
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+      co_return -errno;
+    this->file_readers[fd] = conn.socket;
+    co_await this->wait_ready(conn);
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    this->file_readers.erase(fd);
+  }
+}
+
+void EventLoop::close_finished() {
+  for (int client_socket : this->finished) {
+    this->close_connection(client_socket);
+  }
+  this->finished.clear();
+}
+
+void EventLoop::close_idle_connections() {
+  auto now = std::chrono::steady_clock::now();
+  if (now - this->last_idle_check <
+      std::chrono::milliseconds(IDLE_CHECK_INTERVAL_MS))
+    return;
+  this->last_idle_check = now;
+  this->handler.close_shed_clients();
+
+  auto timeout = std::chrono::seconds(this->server.config.keep_alive_timeout);
+  std::vector<int> idle;
+  for (auto &entry : this->sessions) {
+    const Connection &conn = entry.second.conn;
+    if (conn.state == ConnectionState::READING &&
+        now - conn.last_activity >= timeout) {
+      idle.push_back(entry.first);
+    }
+  }
+  // The suspended coroutines are destroyed with their sessions
+  for (int client_socket : idle) {
+    this->close_connection(client_socket);
+  }
+}
+
+void EventLoop::accept_connections() {
+  // Edge-triggered: accept until the queue of pending clients is empty
+  while (true) {
+    sockaddr_in client_address;
+    socklen_t client_len = sizeof(client_address);
+    int client_socket =
+        accept4(this->listen_socket, (struct sockaddr *)&client_address,
+                &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (client_socket < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      std::cerr << "[ERROR] Failed to accept client connection. errno: "
+                << errno << " (" << strerror(errno) << ")\n";
+      return;
+    }
+
+    this->add_connection(client_socket);
+  }
+}
+
+void EventLoop::close_connection(int client_socket) {
+  auto it = this->sessions.find(client_socket);
+  if (it == this->sessions.end())
+    return;
+  this->handler.release(it->second.conn);
+  if (shutdown(client_socket, SHUT_RDWR) == -1 && errno != ENOTCONN) {
+    std::cerr << "[Error] Failed to shutdown client socket. errno: " << errno
+              << " (" << strerror(errno) << ")\n";
+  }
+  // Closing the socket also removes it from the epoll instance
+  close(client_socket);
+  this->sessions.erase(it);
+}
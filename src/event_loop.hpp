@@ -0,0 +1,91 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "connection.hpp"
+#include "connection_handler.hpp"
+#include "task.hpp"
+#include "transport.hpp"
+#include <chrono>
+#include <coroutine>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Server;
+
+/*
+ * An edge-triggered epoll reactor. The listening socket and all client sockets
+ * are non-blocking, so a slow client never stalls the others. Every client is
+ * served by a coroutine that suspends whenever its socket would block and is
+ * resumed once epoll reports the socket ready.
+ */
+class EventLoop : public Transport {
+public:
+  /*
+   * @param server The server whose evaluate_request answers the requests
+   * @param listen_socket The non-blocking socket to accept clients from (-1 if
+   * the loop only serves clients handed over with adopt)
+   */
+  EventLoop(Server &server, int listen_socket);
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+  ~EventLoop();
+  void run();
+
+  /*
+   * Hands an accepted client over to this loop. Safe to call from any thread.
+   * @param client_socket The non-blocking client socket
+   */
+  void adopt(int client_socket);
+
+  Task<ssize_t> receive(Connection &conn) override;
+  Task<ssize_t> send(Connection &conn, const iovec *iov,
+                     std::size_t count) override;
+  Task<int> send_file(Connection &conn, Response &response) override;
+  Task<ssize_t> read_file(Connection &conn, int fd, char *buffer,
+                          std::size_t length) override;
+
+private:
+  /*
+   * A client and the coroutine serving it
+   */
+  struct Session {
+    Connection conn;
+    Task<> task;
+    std::coroutine_handle<> waiter; // Suspended until the socket is ready
+  };
+  struct Readiness;
+
+  Server &server;
+  ConnectionHandler handler;
+  int listen_socket;
+  int epoll_fd;
+  int wake_fd; // eventfd that signals adopted clients
+  std::mutex adopted_mutex;
+  std::vector<int> adopted;
+  std::vector<char> receive_buffer;
+  std::unordered_map<int, Session> sessions;
+  // The files sessions wait to read from, by the file and the client socket
+  std::unordered_map<int, int> file_readers;
+  std::vector<int> finished; // Sockets whose coroutine returned
+  std::chrono::steady_clock::time_point last_idle_check;
+  void accept_connections();
+  void register_adopted();
+  bool add_connection(int client_socket);
+  /*
+   * The top-level coroutine of a client, marks the session as finished once
+   * the connection ends
+   */
+  Task<> serve(Connection &conn);
+  /*
+   * Suspends the calling coroutine until epoll reports the socket (or the
+   * file it waits to read from) ready
+   */
+  Readiness wait_ready(Connection &conn);
+  void close_finished();
+  void close_connection(int client_socket);
+  void close_idle_connections();
+};
+
+#endif // !EVENT_LOOP_H
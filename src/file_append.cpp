@@ -1,57 +1,282 @@
 #include "file_append.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
-#include <string>
-#include <vector>
+#include <memory>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-bool append_to_file(const std::string &data, const std::string &filename,
-                    int line, int pos) {
-  std::ifstream infile(filename);
-  if (!infile.is_open()) {
-    std::cerr << "Cannot open the file: " << filename << std::endl;
-    return false;
+// Files are read and written through buffers of this size
+const std::size_t FILE_BUFFER_SIZE = 64 << 10;
+
+// Reads a string in place as a stream, without copying it
+class ViewBuffer : public std::streambuf {
+public:
+  explicit ViewBuffer(std::string_view data) {
+    char *begin = const_cast<char *>(data.data());
+    this->setg(begin, begin, begin + data.size());
   }
+};
 
-  std::vector<std::string> lines;
-  std::string current_line;
-  while (std::getline(infile, current_line)) {
-    lines.push_back(current_line);
+// Reads an open file from its start as a stream
+class FileReadBuffer : public std::streambuf {
+public:
+  explicit FileReadBuffer(int fd)
+      : fd(fd), buffer(new char[FILE_BUFFER_SIZE]) {}
+
+protected:
+  int_type underflow() override {
+    ssize_t result;
+    do {
+      result = pread(this->fd, this->buffer.get(), FILE_BUFFER_SIZE,
+                     this->offset);
+    } while (result < 0 && errno == EINTR);
+    if (result <= 0)
+      return traits_type::eof();
+    this->offset += result;
+    this->setg(this->buffer.get(), this->buffer.get(),
+               this->buffer.get() + result);
+    return traits_type::to_int_type(this->buffer[0]);
   }
-  infile.close();
 
-  if (line == -1) {
-    line = static_cast<int>(lines.size()) + 1;
-  } else if (line < 1 || line > static_cast<int>(lines.size()) + 1) {
-    std::cerr << "Line number " << line << " is out of range." << std::endl;
+private:
+  int fd;
+  off_t offset = 0;
+  std::unique_ptr<char[]> buffer;
+};
+
+// Writes to an open file as a stream
+class FileWriteBuffer : public std::streambuf {
+public:
+  explicit FileWriteBuffer(int fd)
+      : fd(fd), buffer(new char[FILE_BUFFER_SIZE]) {
+    this->setp(this->buffer.get(), this->buffer.get() + FILE_BUFFER_SIZE);
+  }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (this->sync() != 0)
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *this->pptr() = traits_type::to_char_type(c);
+      this->pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override {
+    if (!write_all(this->fd, std::string_view(this->pbase(),
+                                              this->pptr() - this->pbase())))
+      return -1;
+    this->setp(this->buffer.get(), this->buffer.get() + FILE_BUFFER_SIZE);
+    return 0;
+  }
+
+private:
+  int fd;
+  std::unique_ptr<char[]> buffer;
+};
+
+// The directory of a file, where its temporary files go
+std::string directory_of_file(const std::string &filename) {
+  std::size_t slash = filename.rfind('/');
+  return slash == std::string::npos ? "." : filename.substr(0, slash);
+}
+
+// Creates an empty file next to the target, the rename into its place has to
+// stay on its file system
+// @return The name of the file or "" if it can't be created
+std::string create_temp_file(const std::string &filename) {
+  std::string temp_name = directory_of_file(filename) + "/.upload-XXXXXX";
+  int fd = mkostemp(temp_name.data(), O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "Cannot create a temporary file for: " << filename
+              << std::endl;
+    return "";
+  }
+  fchmod(fd, 0644);
+  close(fd);
+  return temp_name;
+}
+
+// Renames the temporary file over the target if it was written completely,
+// removes it otherwise
+bool finish_temp_file(const std::string &temp_name,
+                      const std::string &filename, bool written) {
+  if (!written || rename(temp_name.c_str(), filename.c_str()) != 0) {
+    std::cerr << "Cannot write the file: " << filename << std::endl;
+    unlink(temp_name.c_str());
     return false;
   }
+  return true;
+}
+
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t result = write(fd, data.data(), data.size());
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result < 0)
+      return false;
+    data.remove_prefix(result);
+  }
+  return true;
+}
+
+int open_temp_file(const std::string &directory) {
+  int fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    // Without O_TMPFILE the file gets a name that is removed right away, it
+    // is copied instead of linked later
+    std::string temp_name = directory + "/.upload-XXXXXX";
+    fd = mkostemp(temp_name.data(), O_CLOEXEC);
+    if (fd < 0) {
+      std::cerr << "Cannot create a temporary file in: " << directory
+                << std::endl;
+      return -1;
+    }
+    unlink(temp_name.c_str());
+  }
+  // The file becomes the target, so give it the usual mode
+  fchmod(fd, 0644);
+  return fd;
+}
 
-  if (line > static_cast<int>(lines.size())) {
-    lines.push_back("");
+bool link_temp_file(int fd, const std::string &filename) {
+  // linkat doesn't replace a file, so the link gets a name of its own first
+  std::string proc_path = "/proc/self/fd/" + std::to_string(fd);
+  for (int attempt = 0; attempt < 8; ++attempt) {
+    std::string temp_name = create_temp_file(filename);
+    if (temp_name.empty())
+      return false;
+    unlink(temp_name.c_str());
+    if (linkat(AT_FDCWD, proc_path.c_str(), AT_FDCWD, temp_name.c_str(),
+               AT_SYMLINK_FOLLOW) == 0) {
+      return finish_temp_file(temp_name, filename, true);
+    }
+    if (errno != EEXIST)
+      break;
   }
 
-  std::string &target_line = lines[line - 1];
+  // Another file system or no O_TMPFILE, the content is copied
+  std::string temp_name = create_temp_file(filename);
+  if (temp_name.empty())
+    return false;
+  int out = open(temp_name.c_str(), O_WRONLY | O_CLOEXEC);
+  struct stat info;
+  bool copied = out >= 0 && fstat(fd, &info) == 0;
+  off_t offset = 0;
+  while (copied && offset < info.st_size) {
+    ssize_t result = sendfile(out, fd, &offset, info.st_size - offset);
+    if (result < 0 && errno == EINTR)
+      continue;
+    copied = result > 0;
+  }
+  if (out >= 0 && close(out) != 0)
+    copied = false;
+  return finish_temp_file(temp_name, filename, copied);
+}
 
+// Writes a line with the data inserted at the position
+bool write_inserted_line(std::ostream &out, const std::string &line,
+                         std::istream &data, int pos) {
   if (pos == -1) {
-    pos = static_cast<int>(target_line.size());
-  } else if (pos < 0 || pos > static_cast<int>(target_line.size())) {
+    pos = static_cast<int>(line.size());
+  } else if (pos < 0 || pos > static_cast<int>(line.size())) {
     std::cerr << "Position " << pos << " is out of range in the line."
               << std::endl;
     return false;
   }
 
-  target_line.insert(pos, data);
+  out.write(line.data(), pos);
+  // Copied through the stream buffers, block by block
+  if (data.peek() != std::char_traits<char>::eof()) {
+    out << data.rdbuf();
+  }
+  out.write(line.data() + pos, line.size() - pos);
+  out << "\n";
+  return true;
+}
+
+// Copies the file into out line by line, with the data inserted when its
+// line passes
+bool write_appended(std::istream &data, std::istream &infile,
+                    std::ostream &outfile, int line, int pos) {
+  std::string current_line;
+  int lines = 0;
+  bool inserted = false;
+  while (std::getline(infile, current_line)) {
+    ++lines;
+    if (lines == line) {
+      if (!write_inserted_line(outfile, current_line, data, pos))
+        return false;
+      inserted = true;
+    } else {
+      outfile << current_line << "\n";
+    }
+  }
+
+  // Behind the last line the data starts a new one
+  if (!inserted) {
+    if (line != -1 && line != lines + 1) {
+      std::cerr << "Line number " << line << " is out of range." << std::endl;
+      return false;
+    }
+    if (!write_inserted_line(outfile, "", data, pos))
+      return false;
+  }
+  outfile.flush();
+  return !infile.bad() && !outfile.fail();
+}
 
-  std::ofstream outfile(filename);
-  if (!outfile.is_open()) {
+bool append_to_file(std::istream &data, const std::string &filename,
+                    int line, int pos) {
+  std::ifstream infile(filename, std::ios::binary);
+  if (!infile.is_open()) {
     std::cerr << "Cannot open the file: " << filename << std::endl;
     return false;
   }
-
-  for (const auto &l : lines) {
-    outfile << l << "\n";
+  if (line != -1 && line < 1) {
+    std::cerr << "Line number " << line << " is out of range." << std::endl;
+    return false;
   }
 
-  outfile.close();
-  return true;
+  int fd = open_temp_file(directory_of_file(filename));
+  if (fd < 0)
+    return false;
+  FileWriteBuffer buffer(fd);
+  std::ostream outfile(&buffer);
+  bool appended = write_appended(data, infile, outfile, line, pos) &&
+                  link_temp_file(fd, filename);
+  close(fd);
+  return appended;
+}
+
+bool append_to_file(std::string_view data, const std::string &filename,
+                    int line, int pos) {
+  ViewBuffer buffer(data);
+  std::istream stream(&buffer);
+  return append_to_file(stream, filename, line, pos);
+}
+
+bool append_to_file(int data_fd, const std::string &filename, int line,
+                    int pos) {
+  FileReadBuffer buffer(data_fd);
+  std::istream stream(&buffer);
+  return append_to_file(stream, filename, line, pos);
+}
+
+bool replace_file(std::string_view data, const std::string &filename) {
+  int fd = open_temp_file(directory_of_file(filename));
+  if (fd < 0)
+    return false;
+  bool written = write_all(fd, data);
+  if (!written)
+    std::cerr << "Cannot write the file: " << filename << std::endl;
+  bool replaced = written && link_temp_file(fd, filename);
+  close(fd);
+  return replaced;
 }
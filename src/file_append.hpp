@@ -2,16 +2,55 @@
 #define FILE_APPEND_H
 
 #include <string>
+#include <string_view>
 
 /*
- * Append data to any file on a specific line
+ * Append data to any file on a specific line. The file is rewritten into a
+ * temporary file, which replaces it, copying the file line by line and the
+ * data block by block, so neither has to fit into memory.
  * @param data The data to appended
  * @param filename The name of the file you want to append to
  * @param line The line to append to (-1 for EOF)
  * @param pos The position of the cursor in the line (-1 for EOL)
  * @return True if the operation was successfull
  */
-bool append_to_file(const std::string &data, const std::string &filename,
-                   int line, int pos);
+bool append_to_file(std::string_view data, const std::string &filename,
+                    int line, int pos);
+/*
+ * @param data_fd An open file holding the data, read from its start
+ */
+bool append_to_file(int data_fd, const std::string &filename, int line,
+                    int pos);
+
+/*
+ * Replace a file by writing the data to a temporary file and linking that
+ * into its place, so readers of the old file (e.g. a mapping of it) never
+ * see it truncated
+ * @param data The new content of the file
+ * @param filename The name of the file you want to replace
+ * @return True if the operation was successfull
+ */
+bool replace_file(std::string_view data, const std::string &filename);
+
+/*
+ * Opens a temporary file without a name (O_TMPFILE), so nobody sees it
+ * before it's complete and it's gone after a crash
+ * @param directory Where it replaces a file later, the link has to stay on
+ * its file system
+ * @return The open file or -1 if it can't be created
+ */
+int open_temp_file(const std::string &directory);
+
+/*
+ * Gives a file from open_temp_file its name, replacing the file there. It's
+ * copied if it can't be linked (another file system or no O_TMPFILE).
+ * @return True if the operation was successfull
+ */
+bool link_temp_file(int fd, const std::string &filename);
+
+/*
+ * Writes all of the data, retrying after interruptions and short writes
+ */
+bool write_all(int fd, std::string_view data);
 
 #endif // !FILE_APPEND_H
@@ -0,0 +1,313 @@
+#include "file_cache.hpp"
+#include "http_date.hpp"
+#include "respone_header.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <unistd.h>
+
+bool file_changed(const struct stat &info, const struct timespec &mtime,
+                  off_t size, ino_t inode, dev_t device) {
+  return info.st_mtim.tv_sec != mtime.tv_sec ||
+         info.st_mtim.tv_nsec != mtime.tv_nsec || info.st_size != size ||
+         info.st_ino != inode || info.st_dev != device;
+}
+
+std::string_view directory_of(std::string_view path) {
+  std::string_view::size_type slash = path.rfind('/');
+  return slash == std::string_view::npos ? std::string_view(".")
+                                          : path.substr(0, slash);
+}
+
+// Looks for the precompressed siblings of a file in the file system
+Siblings find_siblings(std::string_view path) {
+  Siblings siblings;
+  std::string sibling;
+  for (std::size_t i = 1; i < CODING_COUNT; ++i) {
+    sibling.assign(path).append(coding_suffix(static_cast<ContentCoding>(i)));
+    struct stat result;
+    if (stat(sibling.c_str(), &result) == 0 && S_ISREG(result.st_mode)) {
+      siblings.exists[i] = true;
+      siblings.size[i] = result.st_size;
+      siblings.mtime[i] = result.st_mtime;
+    }
+  }
+  return siblings;
+}
+
+FileCache::FileCache() : watcher(*this) {}
+
+void FileCache::configure(std::size_t total_size, std::size_t max_entry_size) {
+  this->shard_size = total_size / SHARD_COUNT;
+  // An entry has to fit into its shard
+  this->max_entry_size = std::min(max_entry_size, this->shard_size);
+  if (this->enabled() && !this->watcher.start()) {
+    std::cerr << "[ERROR] Can't watch the cached files, they are checked "
+                 "once a second instead\n";
+  }
+}
+
+void FileCache::report_to(FileMappings &mappings) {
+  this->watcher.report_to(mappings);
+}
+
+bool FileCache::watch(std::string_view path) {
+  return this->watcher.watch(directory_of(path));
+}
+
+bool FileCache::enabled() const { return this->shard_size > 0; }
+
+bool FileCache::fits(std::size_t size) const {
+  return this->enabled() && size <= this->max_entry_size;
+}
+
+std::shared_ptr<const CachedFile> FileCache::find(std::string_view path) {
+  if (!this->enabled())
+    return nullptr;
+
+  Shard &shard = this->shard_of(path);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto found = shard.index.find(path);
+  if (found == shard.index.end())
+    return nullptr;
+
+  std::list<Entry>::iterator entry = found->second;
+  std::time_t now = current_second();
+  unsigned long long epoch = this->epoch.load(std::memory_order_acquire);
+  if (!this->current(entry->watched, entry->checked, entry->epoch)) {
+    struct stat result;
+    if (stat(entry->path.c_str(), &result) != 0 ||
+        file_changed(result, entry->mtime, entry->size, entry->inode,
+                     entry->device)) {
+      this->erase(shard, entry);
+      return nullptr;
+    }
+    entry->checked = now;
+    entry->epoch = epoch;
+  }
+
+  shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+  this->hit_count.fetch_add(1, std::memory_order_relaxed);
+  return entry->file;
+}
+
+std::shared_ptr<const CachedFile>
+FileCache::insert(std::string_view path, int fd, const struct stat &info,
+                  std::string_view content_type) {
+  std::size_t size = info.st_size;
+  if (!this->enabled())
+    return nullptr;
+  // Files that are never cached would skew the misses on every request
+  if (!S_ISREG(info.st_mode) || !this->fits(size)) {
+    this->uncacheable_count.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  this->miss_count.fetch_add(1, std::memory_order_relaxed);
+
+  // Watch before reading, a change after the read is reported then
+  unsigned long long epoch = this->epoch.load(std::memory_order_acquire);
+  unsigned long long invalidations =
+      this->invalidations.load(std::memory_order_acquire);
+  bool watched = this->watcher.watch(directory_of(path));
+
+  auto file = std::make_shared<CachedFile>();
+  file->body.resize(size);
+  std::size_t loaded = 0;
+  while (loaded < size) {
+    ssize_t result = pread(fd, file->body.data() + loaded, size - loaded,
+                           loaded);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result <= 0)
+      return nullptr; // The file shrank or broke
+    loaded += result;
+  }
+  // A change before the watch was set is only seen by comparing again
+  struct stat after;
+  if (watched && (fstat(fd, &after) != 0 ||
+                  file_changed(after, info.st_mtim, info.st_size,
+                               info.st_ino, info.st_dev))) {
+    return nullptr;
+  }
+
+  format_http_date(info.st_mtime, file->last_modified);
+  file->head = get_status_line(200);
+  if (size != 0) {
+    file->head.append("Content-Type: ").append(content_type).append("\r\n");
+  }
+  file->head.append("Content-Length: ")
+      .append(std::to_string(size))
+      .append("\r\nLast-Modified: ")
+      .append(file->last_modified, HTTP_DATE_LENGTH)
+      .append("\r\n");
+  file->content_type = content_type;
+  file->mtime = info.st_mtim;
+
+  Entry entry;
+  entry.path = path;
+  entry.file = file;
+  entry.mtime = info.st_mtim;
+  entry.size = info.st_size;
+  entry.inode = info.st_ino;
+  entry.device = info.st_dev;
+  entry.checked = current_second();
+  entry.watched = watched;
+  entry.epoch = epoch;
+  entry.cost = entry.path.size() + file->head.size() + file->body.size();
+
+  Shard &shard = this->shard_of(path);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  // A change reported while the file was read may have come too early to
+  // drop the entry, it gets checked on its first hit then
+  if (this->invalidations.load(std::memory_order_acquire) != invalidations)
+    entry.epoch = epoch - 1;
+  auto found = shard.index.find(path);
+  if (found != shard.index.end()) {
+    this->erase(shard, found->second);
+  }
+  shard.entries.push_front(std::move(entry));
+  Entry &added = shard.entries.front();
+  shard.index[added.path] = shard.entries.begin();
+  shard.size += added.cost;
+
+  while (shard.size > this->shard_size) {
+    this->erase(shard, std::prev(shard.entries.end()));
+  }
+  return file;
+}
+
+Siblings FileCache::siblings(std::string_view path) {
+  if (!this->enabled())
+    return find_siblings(path);
+
+  Shard &shard = this->shard_of(path);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.sibling_index.find(path);
+    if (found != shard.sibling_index.end()) {
+      std::list<SiblingEntry>::iterator entry = found->second;
+      if (this->current(entry->watched, entry->checked, entry->epoch)) {
+        shard.sibling_entries.splice(shard.sibling_entries.begin(),
+                                     shard.sibling_entries, entry);
+        return entry->siblings;
+      }
+    }
+  }
+
+  unsigned long long epoch = this->epoch.load(std::memory_order_acquire);
+  unsigned long long invalidations =
+      this->invalidations.load(std::memory_order_acquire);
+  SiblingEntry entry;
+  // Only the directories of cached files get watched, a lookup doesn't add
+  // a watch for any path a client sends
+  entry.watched = this->watcher.watching(directory_of(path));
+  entry.siblings = find_siblings(path);
+  entry.path = path;
+  entry.checked = current_second();
+  entry.epoch = epoch;
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (this->invalidations.load(std::memory_order_acquire) != invalidations)
+    entry.epoch = epoch - 1;
+  this->erase_siblings(shard, path);
+  shard.sibling_entries.push_front(std::move(entry));
+  SiblingEntry &added = shard.sibling_entries.front();
+  shard.sibling_index[added.path] = shard.sibling_entries.begin();
+  if (shard.sibling_entries.size() > MAX_SIBLING_ENTRIES) {
+    this->erase_siblings(shard, shard.sibling_entries.back().path);
+  }
+  return added.siblings;
+}
+
+void FileCache::invalidate(std::string_view path) {
+  if (!this->enabled())
+    return;
+  this->invalidations.fetch_add(1, std::memory_order_release);
+  {
+    Shard &shard = this->shard_of(path);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(path);
+    if (found != shard.index.end()) {
+      this->erase(shard, found->second);
+    }
+  }
+
+  // A changed sibling changes what its file can be sent as
+  for (std::size_t i = 1; i < CODING_COUNT; ++i) {
+    std::string_view suffix = coding_suffix(static_cast<ContentCoding>(i));
+    if (path.size() <= suffix.size() ||
+        path.substr(path.size() - suffix.size()) != suffix)
+      continue;
+    std::string_view file = path.substr(0, path.size() - suffix.size());
+    Shard &shard = this->shard_of(file);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    this->erase_siblings(shard, file);
+  }
+}
+
+void FileCache::invalidate_directory(std::string_view directory) {
+  this->invalidations.fetch_add(1, std::memory_order_release);
+  for (Shard &shard : this->shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (auto entry = shard.entries.begin(); entry != shard.entries.end();) {
+      auto next = std::next(entry);
+      if (directory_of(entry->path) == directory) {
+        this->erase(shard, entry);
+      }
+      entry = next;
+    }
+    for (auto entry = shard.sibling_entries.begin();
+         entry != shard.sibling_entries.end();) {
+      auto next = std::next(entry);
+      if (directory_of(entry->path) == directory) {
+        this->erase_siblings(shard, entry->path);
+      }
+      entry = next;
+    }
+  }
+}
+
+void FileCache::revalidate_all() {
+  this->epoch.fetch_add(1, std::memory_order_release);
+}
+
+unsigned long long FileCache::hits() const {
+  return this->hit_count.load(std::memory_order_relaxed);
+}
+
+unsigned long long FileCache::misses() const {
+  return this->miss_count.load(std::memory_order_relaxed);
+}
+
+unsigned long long FileCache::uncacheable() const {
+  return this->uncacheable_count.load(std::memory_order_relaxed);
+}
+
+FileCache::Shard &FileCache::shard_of(std::string_view path) {
+  return this->shards[std::hash<std::string_view>{}(path) % SHARD_COUNT];
+}
+
+void FileCache::erase(Shard &shard, std::list<Entry>::iterator entry) {
+  shard.size -= entry->cost;
+  shard.index.erase(entry->path);
+  shard.entries.erase(entry);
+}
+
+void FileCache::erase_siblings(Shard &shard, std::string_view path) {
+  auto found = shard.sibling_index.find(path);
+  if (found == shard.sibling_index.end())
+    return;
+  std::list<SiblingEntry>::iterator entry = found->second;
+  shard.sibling_index.erase(found);
+  shard.sibling_entries.erase(entry);
+}
+
+bool FileCache::current(bool watched, std::time_t checked,
+                        unsigned long long epoch) const {
+  // A watched file only needs a check if changes may have been missed
+  if (watched)
+    return epoch == this->epoch.load(std::memory_order_acquire);
+  return checked == current_second();
+}
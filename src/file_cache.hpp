@@ -0,0 +1,188 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include "content_coding.hpp"
+#include "file_watcher.hpp"
+#include "http_date.hpp"
+#include <atomic>
+#include <cstddef>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unordered_map>
+
+class FileMappings;
+
+/*
+ * A file as the cache hands it out: its content and the head of the 200
+ * response (status line, Content-Type, Content-Length and Last-Modified)
+ * rendered once when the file was read
+ */
+struct CachedFile {
+  std::string head;
+  std::string body;
+  std::string_view content_type; // Interned in the MIME registry
+  char last_modified[HTTP_DATE_LENGTH];
+  struct timespec mtime; // Of the file when it was read
+};
+
+/*
+ * True if the stat shows another file or content than the recorded one
+ */
+bool file_changed(const struct stat &info, const struct timespec &mtime,
+                  off_t size, ino_t inode, dev_t device);
+
+/*
+ * The directory part of a key, "." for "./index.html"
+ */
+std::string_view directory_of(std::string_view path);
+
+/*
+ * Keeps small files in memory, so the hot ones are served without opening,
+ * stat'ing or reading them. The entries are spread over shards with a lock
+ * and an LRU list each, the least recently used entries of a shard are
+ * evicted once it outgrows its share of the total size. The directories of
+ * the entries are watched for changes, a hit doesn't touch the file system.
+ * Where no watch can be set, an entry is checked against its file (mtime,
+ * size and inode) at most once a second instead. Which precompressed
+ * siblings a file has is cached the same way, for files of any size.
+ */
+class FileCache {
+public:
+  /*
+   * @param total_size The bytes all entries may take together (0 = no cache)
+   * @param max_entry_size Larger files aren't cached
+   */
+  FileCache();
+  /*
+   * Starts watching the files if the cache is enabled
+   */
+  void configure(std::size_t total_size, std::size_t max_entry_size);
+  bool enabled() const;
+  /*
+   * True if a file of this size would be cached
+   */
+  bool fits(std::size_t size) const;
+
+  /*
+   * @param path The normalized path of the file
+   * @return The cached file or nullptr on a miss (the entry is dropped if the
+   * file changed since it was read). A miss is only counted once insert
+   * knows if the file can be cached.
+   */
+  std::shared_ptr<const CachedFile> find(std::string_view path);
+
+  /*
+   * Reads an open file into a new entry, replacing an older one of the path.
+   * Counts a miss, or an uncacheable file if it isn't regular or too large.
+   * @param info The stat of the open file
+   * @param content_type The type of the file, it has to outlive the cache
+   * @return The new entry or nullptr if the file can't be cached
+   */
+  std::shared_ptr<const CachedFile> insert(std::string_view path, int fd,
+                                           const struct stat &info,
+                                           std::string_view content_type);
+
+  /*
+   * The precompressed siblings of a file, found with a stat of each only
+   * when the cached answer may be outdated
+   * @param path The normalized path of the file
+   */
+  Siblings siblings(std::string_view path);
+
+  /*
+   * Has the watcher drop the mappings of the files that change as well,
+   * before the cache is configured
+   */
+  void report_to(FileMappings &mappings);
+  /*
+   * Watches the directory of a file that isn't cached, e.g. a mapped one
+   * @return True if changes of the file get reported
+   */
+  bool watch(std::string_view path);
+
+  /*
+   * Drops the entry of a file the server changed
+   */
+  void invalidate(std::string_view path);
+  /*
+   * Drops the entries of the files in a directory
+   * @param directory The directory as the keys name it, e.g. "./docs"
+   */
+  void invalidate_directory(std::string_view directory);
+  /*
+   * Makes every entry get checked against its file on its next hit, for when
+   * changes may have been missed
+   */
+  void revalidate_all();
+
+  unsigned long long hits() const;
+  unsigned long long misses() const;
+  unsigned long long uncacheable() const;
+
+private:
+  static const unsigned int SHARD_COUNT = 16;
+  // The files whose siblings a shard remembers
+  static const std::size_t MAX_SIBLING_ENTRIES = 1024;
+
+  struct Entry {
+    std::string path;
+    std::shared_ptr<const CachedFile> file;
+    struct timespec mtime;
+    off_t size;
+    ino_t inode;
+    dev_t device;
+    std::time_t checked; // The second the file was last compared
+    bool watched;        // Changes of the file get reported
+    unsigned long long epoch; // The revalidation epoch it was checked in
+    std::size_t cost;    // The bytes the entry counts against the limit
+  };
+
+  struct SiblingEntry {
+    std::string path; // The file the siblings are of
+    Siblings siblings;
+    std::time_t checked;
+    bool watched;
+    unsigned long long epoch;
+  };
+
+  /*
+   * The most recently used entries are at the front of the lists, the
+   * indexes view the paths of the list nodes
+   */
+  struct Shard {
+    std::mutex mutex;
+    std::list<Entry> entries;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    std::size_t size = 0;
+    std::list<SiblingEntry> sibling_entries;
+    std::unordered_map<std::string_view, std::list<SiblingEntry>::iterator>
+        sibling_index;
+  };
+
+  Shard shards[SHARD_COUNT];
+  std::size_t shard_size = 0;
+  std::size_t max_entry_size = 0;
+  std::atomic<unsigned long long> hit_count{0};
+  std::atomic<unsigned long long> miss_count{0};
+  std::atomic<unsigned long long> uncacheable_count{0};
+  std::atomic<unsigned long long> epoch{0};
+  std::atomic<unsigned long long> invalidations{0};
+  // Last, its thread stops before the shards are gone
+  FileWatcher watcher;
+
+  Shard &shard_of(std::string_view path);
+  void erase(Shard &shard, std::list<Entry>::iterator entry);
+  void erase_siblings(Shard &shard, std::string_view path);
+  /*
+   * True if an entry checked in that second and epoch needs no new check
+   */
+  bool current(bool watched, std::time_t checked,
+               unsigned long long epoch) const;
+};
+
+#endif // !FILE_CACHE_H
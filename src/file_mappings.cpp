@@ -0,0 +1,113 @@
+#include "file_mappings.hpp"
+#include "file_cache.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <iterator>
+#include <sys/mman.h>
+#include <unistd.h>
+
+FileMapping::~FileMapping() {
+  munmap(const_cast<char *>(this->data), this->size);
+  close(this->fd);
+}
+
+bool FileMapping::intact() const {
+  struct stat info;
+  return fstat(this->fd, &info) == 0 &&
+         static_cast<std::size_t>(info.st_size) >= this->size;
+}
+
+void FileMappings::configure(std::size_t budget, FileCache &cache) {
+  this->budget = budget;
+  this->cache = &cache;
+  if (this->enabled())
+    cache.report_to(*this);
+}
+
+bool FileMappings::enabled() const { return this->budget > 0; }
+
+std::shared_ptr<const FileMapping>
+FileMappings::map(std::string_view path, int fd, const struct stat &info) {
+  std::size_t size = info.st_size;
+  if (!S_ISREG(info.st_mode) || size == 0 || size > this->budget)
+    return nullptr;
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  auto found = this->index.find(path);
+  if (found != this->index.end()) {
+    std::list<Entry>::iterator entry = found->second;
+    if (!file_changed(info, entry->mtime, entry->size, entry->inode,
+                      entry->device)) {
+      this->entries.splice(this->entries.begin(), this->entries, entry);
+      return entry->mapping;
+    }
+    this->erase(entry);
+  }
+
+  // The caller keeps its descriptor, the mapping checks the file with its own
+  int kept_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  void *data = kept_fd < 0 ? MAP_FAILED
+                           : mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    std::cerr << "[ERROR] Failed to map the file. errno: " << errno << " ("
+              << strerror(errno) << ")\n";
+    if (kept_fd >= 0)
+      close(kept_fd);
+    return nullptr;
+  }
+  // The clients read the file front to back, the next pages are read ahead
+  madvise(data, size, MADV_SEQUENTIAL);
+  madvise(data, size, MADV_WILLNEED);
+  auto mapping =
+      std::make_shared<const FileMapping>(static_cast<char *>(data), size,
+                                          kept_fd);
+
+  while (!this->entries.empty() && this->mapped + size > this->budget) {
+    this->erase(std::prev(this->entries.end()));
+  }
+
+  Entry entry;
+  entry.path = path;
+  entry.mapping = mapping;
+  entry.mtime = info.st_mtim;
+  entry.size = info.st_size;
+  entry.inode = info.st_ino;
+  entry.device = info.st_dev;
+  this->entries.push_front(std::move(entry));
+  this->index[this->entries.front().path] = this->entries.begin();
+  this->mapped += size;
+  // A change before the watch was set is still seen by the next map
+  this->cache->watch(path);
+  return mapping;
+}
+
+void FileMappings::invalidate(std::string_view path) {
+  if (!this->enabled())
+    return;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  auto found = this->index.find(path);
+  if (found != this->index.end()) {
+    this->erase(found->second);
+  }
+}
+
+void FileMappings::invalidate_directory(std::string_view directory) {
+  if (!this->enabled())
+    return;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for (auto entry = this->entries.begin(); entry != this->entries.end();) {
+    auto next = std::next(entry);
+    if (directory_of(entry->path) == directory) {
+      this->erase(entry);
+    }
+    entry = next;
+  }
+}
+
+void FileMappings::erase(std::list<Entry>::iterator entry) {
+  this->mapped -= entry->mapping->size;
+  this->index.erase(entry->path);
+  this->entries.erase(entry);
+}
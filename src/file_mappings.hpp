@@ -0,0 +1,99 @@
+#ifndef FILE_MAPPINGS_H
+#define FILE_MAPPINGS_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unordered_map>
+
+/*
+ * A read-only mapping of a whole file, unmapped with its last reference. The
+ * file stays open, so it can be checked for having been truncated.
+ */
+struct FileMapping {
+  const char *data;
+  std::size_t size;
+  int fd;
+
+  FileMapping(const char *data, std::size_t size, int fd)
+      : data(data), size(size), fd(fd) {}
+  FileMapping(const FileMapping &) = delete;
+  FileMapping &operator=(const FileMapping &) = delete;
+  ~FileMapping();
+
+  /*
+   * False once the file shrank below the mapping, reading the pages past
+   * its end faults
+   */
+  bool intact() const;
+};
+
+class FileCache;
+
+/*
+ * Maps files once and shares the mapping between all responses sending the
+ * file, so many clients downloading the same file share its page cache pages
+ * instead of each reading a copy. The mappings are reference counted: a
+ * mapping dropped because its file changed or the mapped bytes outgrew the
+ * budget (least recently used first) is unmapped once the last response
+ * sending it is out. The directories of the mapped files are watched by the
+ * watcher of the file cache, which drops the mappings of changed files.
+ */
+class FileMappings {
+public:
+  /*
+   * Has to be called before the file cache is configured, its watcher
+   * thread reports to the mappings from then on
+   * @param budget The bytes mapped at the same time (0 = no mappings)
+   * @param cache The cache whose watcher watches the mapped files
+   */
+  void configure(std::size_t budget, FileCache &cache);
+  bool enabled() const;
+
+  /*
+   * The shared mapping of an open file, mapped now unless the mapping of the
+   * path is still of this file
+   * @param path The normalized path of the file
+   * @param info The stat of the open file
+   * @return The mapping or nullptr if the file can't be mapped (too large for
+   * the budget, not a regular file or mmap failed)
+   */
+  std::shared_ptr<const FileMapping> map(std::string_view path, int fd,
+                                         const struct stat &info);
+
+  /*
+   * Drops the mapping of a file that changed
+   */
+  void invalidate(std::string_view path);
+  /*
+   * Drops the mappings of the files in a directory
+   * @param directory The directory as the paths name it, e.g. "./docs"
+   */
+  void invalidate_directory(std::string_view directory);
+
+private:
+  struct Entry {
+    std::string path;
+    std::shared_ptr<const FileMapping> mapping;
+    struct timespec mtime;
+    off_t size;
+    ino_t inode;
+    dev_t device;
+  };
+
+  std::mutex mutex;
+  // The most recently used mappings first, the index views the paths
+  std::list<Entry> entries;
+  std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+  std::size_t mapped = 0;
+  std::size_t budget = 0;
+  FileCache *cache = nullptr;
+
+  void erase(std::list<Entry>::iterator entry);
+};
+
+#endif // !FILE_MAPPINGS_H
@@ -0,0 +1,198 @@
+#include "file_watcher.hpp"
+#include "auth.hpp"
+#include "file_cache.hpp"
+#include "file_mappings.hpp"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// What makes a cached file stale: its content, its metadata or its name
+const uint32_t WATCHED_EVENTS = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                                IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                IN_ONLYDIR;
+// Every entry is checked against its file this often anyway, for changes
+// inotify doesn't report
+const auto REVALIDATE_INTERVAL = std::chrono::seconds(60);
+
+FileWatcher::FileWatcher(FileCache &cache) : cache(cache) {}
+
+void FileWatcher::report_to(FileMappings &mappings) {
+  this->mappings = &mappings;
+}
+
+FileWatcher::~FileWatcher() {
+  if (this->thread.joinable()) {
+    uint64_t stop = 1;
+    if (write(this->stop_fd, &stop, sizeof(stop)) == sizeof(stop)) {
+      this->thread.join();
+    } else {
+      this->thread.detach();
+    }
+  }
+  if (this->inotify_fd >= 0)
+    close(this->inotify_fd);
+  if (this->stop_fd >= 0)
+    close(this->stop_fd);
+}
+
+bool FileWatcher::start() {
+  if (this->thread.joinable())
+    return true;
+
+  this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (this->inotify_fd < 0) {
+    std::cerr << "[ERROR] Failed to set up inotify. errno: " << errno << " ("
+              << strerror(errno) << ")\n";
+    return false;
+  }
+  this->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->stop_fd < 0) {
+    std::cerr << "[ERROR] Failed to create the watcher's eventfd. errno: "
+              << errno << " (" << strerror(errno) << ")\n";
+    close(this->inotify_fd);
+    this->inotify_fd = -1;
+    return false;
+  }
+
+  // The served directory holds the list file, which is always watched
+  this->watch(".");
+
+  // The signals are handled by the other threads, the thread inherits the
+  // blocked mask
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &previous);
+  this->thread = std::thread(&FileWatcher::run, this);
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+  return true;
+}
+
+bool FileWatcher::watch(std::string_view directory) {
+  if (this->inotify_fd < 0)
+    return false;
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::string name(directory);
+  if (this->watches.count(name) != 0)
+    return true;
+
+  int wd = inotify_add_watch(this->inotify_fd, name.c_str(), WATCHED_EVENTS);
+  if (wd < 0) {
+    // Out of watches, the files of the directory get checked once a second
+    if (errno == ENOSPC && !this->limit_reported) {
+      this->limit_reported = true;
+      std::cerr << "[ERROR] Reached the inotify watch limit, see "
+                   "/proc/sys/fs/inotify/max_user_watches\n";
+    }
+    return false;
+  }
+  // The events of a directory reached by another name (through "..") name
+  // the first one, the files of this name get checked once a second
+  if (this->directories.count(wd) != 0)
+    return false;
+  this->watches[name] = wd;
+  this->directories[wd] = name;
+  return true;
+}
+
+bool FileWatcher::watching(std::string_view directory) {
+  if (this->inotify_fd < 0)
+    return false;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->watches.count(std::string(directory)) != 0;
+}
+
+void FileWatcher::run() {
+  alignas(inotify_event) char buffer[16 << 10];
+  pollfd fds[2];
+  fds[0].fd = this->inotify_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = this->stop_fd;
+  fds[1].events = POLLIN;
+
+  auto next_revalidation = std::chrono::steady_clock::now() +
+                           REVALIDATE_INTERVAL;
+  while (true) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_revalidation) {
+      this->cache.revalidate_all();
+      next_revalidation = now + REVALIDATE_INTERVAL;
+    }
+    int timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      next_revalidation - now)
+                      .count();
+
+    int ready = poll(fds, 2, timeout);
+    if (ready < 0 && errno != EINTR) {
+      std::cerr << "[ERROR] Waiting for file changes failed. errno: " << errno
+                << " (" << strerror(errno) << ")\n";
+      return;
+    }
+    if (ready <= 0)
+      continue;
+    if (fds[1].revents & POLLIN)
+      return;
+
+    ssize_t length = read(this->inotify_fd, buffer, sizeof(buffer));
+    if (length <= 0)
+      continue;
+    for (char *event = buffer; event < buffer + length;) {
+      const inotify_event &current =
+          *reinterpret_cast<const inotify_event *>(event);
+      this->handle(current);
+      event += sizeof(inotify_event) + current.len;
+    }
+  }
+}
+
+void FileWatcher::handle(const inotify_event &event) {
+  if (event.mask & IN_Q_OVERFLOW) {
+    // Some changes are lost, every entry has to be checked again
+    this->cache.revalidate_all();
+    return;
+  }
+
+  std::string directory;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->directories.find(event.wd);
+    if (found == this->directories.end())
+      return;
+    directory = found->second;
+    if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+      // The watch is gone or follows the directory to its new name, the
+      // next entry of the old name watches it again
+      this->watches.erase(directory);
+      this->directories.erase(found);
+      if (event.mask & IN_MOVE_SELF)
+        inotify_rm_watch(this->inotify_fd, event.wd);
+    }
+  }
+
+  if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+    this->cache.invalidate_directory(directory);
+    if (this->mappings)
+      this->mappings->invalidate_directory(directory);
+    return;
+  }
+  if (event.len == 0)
+    return;
+
+  // The names in the events are relative to the watched directory
+  std::string path = directory;
+  path.push_back('/');
+  path.append(event.name);
+  this->cache.invalidate(path);
+  if (this->mappings)
+    this->mappings->invalidate(path);
+  if (path == LIST_FILE)
+    reload_lists();
+}
@@ -0,0 +1,69 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/inotify.h>
+#include <thread>
+#include <unordered_map>
+
+class FileCache;
+class FileMappings;
+
+/*
+ * Watches the directories of the cached (and mapped) files with inotify on a
+ * thread of its own and drops the entries and mappings of files that get
+ * modified, replaced, moved or deleted, by the server or by anyone else.
+ * Changes of the list file make the threads read their lists again. Events
+ * that got lost because the queue overflowed (and changes inotify doesn't
+ * see, e.g. of a moved parent directory) are caught up on by checking every
+ * entry against its file again, right after an overflow and periodically.
+ */
+class FileWatcher {
+public:
+  explicit FileWatcher(FileCache &cache);
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+  ~FileWatcher();
+
+  /*
+   * Drops the mappings of changed files as well, before the thread starts
+   */
+  void report_to(FileMappings &mappings);
+
+  /*
+   * Starts the thread and watches the served directory
+   * @return False if inotify isn't available
+   */
+  bool start();
+
+  /*
+   * Watches a directory unless it is watched already
+   * @param directory The directory as the cache keys name it, e.g. "./docs"
+   * @return True if changes of the files in it get reported
+   */
+  bool watch(std::string_view directory);
+
+  /*
+   * True if changes of the files in the directory get reported, without
+   * adding a watch
+   */
+  bool watching(std::string_view directory);
+
+private:
+  FileCache &cache;
+  FileMappings *mappings = nullptr;
+  int inotify_fd = -1;
+  int stop_fd = -1; // An eventfd that wakes the thread up to return
+  std::thread thread;
+  std::mutex mutex; // Guards the watch maps, the workers add watches
+  std::unordered_map<std::string, int> watches;
+  std::unordered_map<int, std::string> directories;
+  bool limit_reported = false;
+
+  void run();
+  void handle(const inotify_event &event);
+};
+
+#endif // !FILE_WATCHER_H
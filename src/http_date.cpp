@@ -0,0 +1,80 @@
+#include "http_date.hpp"
+#include <atomic>
+#include <mutex>
+
+const char *const WEEKDAYS[] = {"Sun", "Mon", "Tue", "Wed",
+                                "Thu", "Fri", "Sat"};
+const char *const MONTHS[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                              "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+// The formatted dates rotate through a few buffers, a reader copying the
+// current one never sees it overwritten by the next second
+const unsigned int DATE_SLOTS = 4;
+char DATES[DATE_SLOTS][HTTP_DATE_LENGTH];
+std::atomic<unsigned int> CURRENT_DATE{0};
+std::atomic<std::time_t> DATE_SECOND{0};
+std::mutex DATE_MUTEX;
+
+void write_two_digits(char *out, int value) {
+  out[0] = '0' + value / 10;
+  out[1] = '0' + value % 10;
+}
+
+void format_http_date(std::time_t time, char *out) {
+  std::tm gmt;
+  gmtime_r(&time, &gmt);
+
+  const char *weekday = WEEKDAYS[gmt.tm_wday];
+  const char *month = MONTHS[gmt.tm_mon];
+  int year = gmt.tm_year + 1900;
+
+  out[0] = weekday[0];
+  out[1] = weekday[1];
+  out[2] = weekday[2];
+  out[3] = ',';
+  out[4] = ' ';
+  write_two_digits(out + 5, gmt.tm_mday);
+  out[7] = ' ';
+  out[8] = month[0];
+  out[9] = month[1];
+  out[10] = month[2];
+  out[11] = ' ';
+  write_two_digits(out + 12, year / 100 % 100);
+  write_two_digits(out + 14, year % 100);
+  out[16] = ' ';
+  write_two_digits(out + 17, gmt.tm_hour);
+  out[19] = ':';
+  write_two_digits(out + 20, gmt.tm_min);
+  out[22] = ':';
+  write_two_digits(out + 23, gmt.tm_sec);
+  out[25] = ' ';
+  out[26] = 'G';
+  out[27] = 'M';
+  out[28] = 'T';
+}
+
+void refresh_http_date() {
+  std::time_t now = std::time(nullptr);
+  if (DATE_SECOND.load(std::memory_order_acquire) == now)
+    return;
+
+  // One thread formats the new second, the others keep the previous one
+  std::unique_lock<std::mutex> lock(DATE_MUTEX, std::try_to_lock);
+  if (!lock.owns_lock() || DATE_SECOND.load(std::memory_order_relaxed) == now)
+    return;
+
+  unsigned int next = (CURRENT_DATE.load(std::memory_order_relaxed) + 1) %
+                      DATE_SLOTS;
+  format_http_date(now, DATES[next]);
+  CURRENT_DATE.store(next, std::memory_order_release);
+  DATE_SECOND.store(now, std::memory_order_release);
+}
+
+std::string_view current_http_date() {
+  unsigned int current = CURRENT_DATE.load(std::memory_order_acquire);
+  return std::string_view(DATES[current], HTTP_DATE_LENGTH);
+}
+
+std::time_t current_second() {
+  return DATE_SECOND.load(std::memory_order_acquire);
+}
@@ -0,0 +1,36 @@
+#ifndef HTTP_DATE_H
+#define HTTP_DATE_H
+
+#include <cstddef>
+#include <ctime>
+#include <string_view>
+
+// "Sun, 06 Nov 1994 08:49:37 GMT"
+const std::size_t HTTP_DATE_LENGTH = 29;
+
+/*
+ * Formats a point in time as an RFC 7231 date
+ * @param out Room for HTTP_DATE_LENGTH bytes, no terminating null is written
+ */
+void format_http_date(std::time_t time, char *out);
+
+/*
+ * Reformats the shared date if the second changed. The event loops call it
+ * whenever they wake up, so it is at most a second old. The first call has
+ * to happen before the other threads start.
+ */
+void refresh_http_date();
+
+/*
+ * The shared date of the current second for the Date header. Copy it right
+ * away, the buffer behind it is reused a few seconds later.
+ */
+std::string_view current_http_date();
+
+/*
+ * The second the shared date shows, a clock without a system call for checks
+ * that only need to happen once a second
+ */
+std::time_t current_second();
+
+#endif // !HTTP_DATE_H
@@ -0,0 +1,240 @@
+#include "io_uring.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+// The operations the io_uring backend of the server is built on
+const unsigned char REQUIRED_OPS[] = {
+    IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+    IORING_OP_SENDMSG, IORING_OP_READ, IORING_OP_TIMEOUT,
+    IORING_OP_PROVIDE_BUFFERS, IORING_OP_ASYNC_CANCEL, IORING_OP_POLL_ADD};
+
+IoUring::IoUring(unsigned int entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_COOP_TASKRUN;
+  this->ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (this->ring_fd < 0 && errno == EINVAL) {
+    // Older kernels don't know the flag
+    memset(&params, 0, sizeof(params));
+    this->ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+  }
+  if (this->ring_fd < 0) {
+    std::cerr << "[ERROR] Setting up io_uring failed. errno: " << errno << " ("
+              << strerror(errno) << ")\n";
+    throw "[SERVER] io_uring is not available\n";
+  }
+
+  std::vector<char> probe_memory(sizeof(io_uring_probe) +
+                                 IORING_OP_LAST * sizeof(io_uring_probe_op));
+  io_uring_probe *probe =
+      reinterpret_cast<io_uring_probe *>(probe_memory.data());
+  if (syscall(__NR_io_uring_register, this->ring_fd, IORING_REGISTER_PROBE,
+              probe, IORING_OP_LAST) < 0) {
+    this->release();
+    throw "[SERVER] io_uring can't be probed for its operations\n";
+  }
+  for (unsigned char op : REQUIRED_OPS) {
+    if (op > probe->last_op ||
+        !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      this->release();
+      throw "[SERVER] io_uring lacks an operation the server needs\n";
+    }
+  }
+
+  this->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  this->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    this->sq_ring_size = this->cq_ring_size =
+        std::max(this->sq_ring_size, this->cq_ring_size);
+  }
+
+  this->sq_ring = mmap(nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, this->ring_fd,
+                       IORING_OFF_SQ_RING);
+  if (this->sq_ring == MAP_FAILED) {
+    this->sq_ring = nullptr;
+    this->release();
+    throw "[SERVER] Mapping the io_uring submission ring failed\n";
+  }
+  if (single_mmap) {
+    this->cq_ring = this->sq_ring;
+  } else {
+    this->cq_ring = mmap(nullptr, this->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, this->ring_fd,
+                         IORING_OFF_CQ_RING);
+    if (this->cq_ring == MAP_FAILED) {
+      this->cq_ring = nullptr;
+      this->release();
+      throw "[SERVER] Mapping the io_uring completion ring failed\n";
+    }
+  }
+
+  this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    this->release();
+    throw "[SERVER] Mapping the io_uring submission entries failed\n";
+  }
+  this->sqes = static_cast<io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(this->sq_ring);
+  this->sq_head = reinterpret_cast<unsigned int *>(sq + params.sq_off.head);
+  this->sq_tail = reinterpret_cast<unsigned int *>(sq + params.sq_off.tail);
+  this->sq_mask =
+      reinterpret_cast<unsigned int *>(sq + params.sq_off.ring_mask);
+  this->sq_array = reinterpret_cast<unsigned int *>(sq + params.sq_off.array);
+  this->sq_local_tail = *this->sq_tail;
+  this->sq_entries = params.sq_entries;
+
+  char *cq = static_cast<char *>(this->cq_ring);
+  this->cq_head = reinterpret_cast<unsigned int *>(cq + params.cq_off.head);
+  this->cq_tail = reinterpret_cast<unsigned int *>(cq + params.cq_off.tail);
+  this->cq_mask =
+      reinterpret_cast<unsigned int *>(cq + params.cq_off.ring_mask);
+  this->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() { this->release(); }
+
+void IoUring::release() {
+  delete[] this->buffers;
+  this->buffers = nullptr;
+  if (this->sqes) {
+    munmap(this->sqes, this->sqes_size);
+    this->sqes = nullptr;
+  }
+  if (this->cq_ring && this->cq_ring != this->sq_ring) {
+    munmap(this->cq_ring, this->cq_ring_size);
+  }
+  this->cq_ring = nullptr;
+  if (this->sq_ring) {
+    munmap(this->sq_ring, this->sq_ring_size);
+    this->sq_ring = nullptr;
+  }
+  if (this->ring_fd >= 0) {
+    close(this->ring_fd);
+    this->ring_fd = -1;
+  }
+}
+
+io_uring_sqe *IoUring::get_sqe() {
+  io_uring_sqe *sqe;
+  return this->get_sqes(&sqe, 1) ? sqe : nullptr;
+}
+
+bool IoUring::get_sqes(io_uring_sqe **sqes, unsigned int count) {
+  unsigned int head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+  if (this->sq_entries - (this->sq_local_tail - head) < count) {
+    this->submit_and_wait(0);
+    head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+    if (this->sq_entries - (this->sq_local_tail - head) < count)
+      return false;
+  }
+
+  for (unsigned int i = 0; i < count; ++i) {
+    unsigned int index = this->sq_local_tail & *this->sq_mask;
+    this->sq_array[index] = index;
+    ++this->sq_local_tail;
+    sqes[i] = &this->sqes[index];
+    memset(sqes[i], 0, sizeof(io_uring_sqe));
+  }
+  return true;
+}
+
+int IoUring::submit_and_wait(unsigned int wait_nr) {
+  // Publish the prepared entries, the kernel consumes them from its head
+  __atomic_store_n(this->sq_tail, this->sq_local_tail, __ATOMIC_RELEASE);
+  unsigned int to_submit =
+      this->sq_local_tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+
+  unsigned int flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int result = syscall(__NR_io_uring_enter, this->ring_fd, to_submit, wait_nr,
+                       flags, nullptr, 0);
+  if (result < 0)
+    return -errno;
+  this->in_flight += result;
+  return result;
+}
+
+io_uring_cqe *IoUring::peek_cqe() {
+  unsigned int head = *this->cq_head;
+  if (head == __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE))
+    return nullptr;
+  return &this->cqes[head & *this->cq_mask];
+}
+
+void IoUring::cqe_seen() {
+  unsigned int head = *this->cq_head;
+  // A multishot operation stays in flight while it announces more completions
+  if (!(this->cqes[head & *this->cq_mask].flags & IORING_CQE_F_MORE))
+    --this->in_flight;
+  __atomic_store_n(this->cq_head, head + 1, __ATOMIC_RELEASE);
+}
+
+void IoUring::wait_idle() {
+  while (true) {
+    while (this->peek_cqe() != nullptr) {
+      this->cqe_seen();
+    }
+    bool unsubmitted = this->sq_local_tail !=
+                       __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+    if (this->in_flight == 0 && !unsubmitted)
+      return;
+    int result = this->submit_and_wait(1);
+    if (result < 0 && result != -EINTR && result != -EAGAIN &&
+        result != -EBUSY) {
+      std::cerr << "[ERROR] Waiting for the io_uring operations failed. "
+                << "errno: " << -result << " (" << strerror(-result) << ")\n";
+      return;
+    }
+  }
+}
+
+void IoUring::provide_buffers(unsigned int count, unsigned int size) {
+  this->buffers = new char[static_cast<std::size_t>(count) * size];
+  this->buf_size = size;
+
+  io_uring_sqe *sqe = this->get_sqe();
+  if (sqe == nullptr) {
+    throw "[SERVER] Providing the io_uring receive buffers failed\n";
+  }
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = count;
+  sqe->addr = reinterpret_cast<uint64_t>(this->buffers);
+  sqe->len = size;
+  sqe->off = 0;
+  sqe->buf_group = 0;
+  sqe->user_data = 0;
+}
+
+char *IoUring::buffer(unsigned short id) {
+  return this->buffers + static_cast<std::size_t>(id) * this->buf_size;
+}
+
+std::size_t IoUring::buffer_size() const { return this->buf_size; }
+
+void IoUring::recycle_buffer(unsigned short id) {
+  // Goes out with the next submission, the completion carries user_data 0
+  io_uring_sqe *sqe = this->get_sqe();
+  if (sqe == nullptr) {
+    std::cerr << "[ERROR] The io_uring submission ring is full, lost receive "
+              << "buffer " << id << "\n";
+    return;
+  }
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = 1;
+  sqe->addr = reinterpret_cast<uint64_t>(this->buffer(id));
+  sqe->len = this->buf_size;
+  sqe->off = id;
+  sqe->buf_group = 0;
+  sqe->user_data = 0;
+}
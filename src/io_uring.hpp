@@ -0,0 +1,106 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+/*
+ * A minimal io_uring instance built directly on the system calls: the
+ * submission and completion rings plus one group of provided buffers the
+ * kernel picks receive buffers from.
+ */
+class IoUring {
+public:
+  /*
+   * Sets up the rings, throws if the kernel doesn't support io_uring or one
+   * of the operations the server needs
+   * @param entries The size of the submission ring
+   */
+  IoUring(unsigned int entries);
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+  ~IoUring();
+
+  /*
+   * Returns a cleared submission entry, submits the pending ones if the
+   * submission ring is full
+   */
+  io_uring_sqe *get_sqe();
+
+  /*
+   * Reserves several cleared submission entries at once, for linked entries
+   * that have to go out together. The pending entries are submitted first
+   * if the ring lacks room for all of them, never in between.
+   * @param sqes Where to put the entries
+   * @return False if the ring has no room for count entries
+   */
+  bool get_sqes(io_uring_sqe **sqes, unsigned int count);
+
+  /*
+   * Submits all prepared entries and waits for completions in one system call
+   * @param wait_nr The number of completions to wait for
+   * @return The number of submitted entries or -errno
+   */
+  int submit_and_wait(unsigned int wait_nr);
+
+  /*
+   * @return The next completion or nullptr if there is none
+   */
+  io_uring_cqe *peek_cqe();
+  void cqe_seen();
+
+  /*
+   * Submits the prepared entries and throws completions away until no
+   * operation is in flight. Afterwards the kernel no longer touches the
+   * memory the operations pointed to. Operations that never complete on
+   * their own have to be cancelled first.
+   */
+  void wait_idle();
+
+  /*
+   * Allocates the receive buffers and queues handing them to the kernel as
+   * buffer group 0, they go out with the next submission
+   * @param count The number of buffers
+   * @param size The size of every buffer
+   */
+  void provide_buffers(unsigned int count, unsigned int size);
+  char *buffer(unsigned short id);
+  std::size_t buffer_size() const;
+
+  /*
+   * Hands a provided buffer back to the kernel after its data was consumed
+   */
+  void recycle_buffer(unsigned short id);
+
+private:
+  int ring_fd = -1;
+  void *sq_ring = nullptr;
+  void *cq_ring = nullptr;
+  std::size_t sq_ring_size = 0;
+  std::size_t cq_ring_size = 0;
+  io_uring_sqe *sqes = nullptr;
+  std::size_t sqes_size = 0;
+
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int sq_local_tail = 0;
+  unsigned int sq_entries = 0;
+
+  // Submitted operations whose last completion wasn't seen yet
+  unsigned int in_flight = 0;
+
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  io_uring_cqe *cqes;
+
+  char *buffers = nullptr;
+  unsigned int buf_size = 0;
+
+  void release();
+};
+
+#endif // !IO_URING_H
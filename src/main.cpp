@@ -17,6 +17,106 @@ int main(int argc, char *argv[]) {
       .nargs(1)
       .default_value(8080)
       .scan<'i', int>();
+  program.add_argument("-t", "--threads")
+      .help("The number of worker threads serving the clients.")
+      .nargs(1)
+      .default_value(1)
+      .scan<'i', int>();
+  program.add_argument("-r", "--reuseport")
+      .help("Give every worker thread its own SO_REUSEPORT listener.")
+      .flag();
+  program.add_argument("-b", "--backlog")
+      .help("The length of the queue of pending connections.")
+      .nargs(1)
+      .default_value(10)
+      .scan<'i', int>();
+  program.add_argument("-k", "--keep-alive-timeout")
+      .help("Seconds an idle persistent connection is kept open.")
+      .nargs(1)
+      .default_value(5)
+      .scan<'i', int>();
+  program.add_argument("-m", "--max-requests")
+      .help("The number of requests served over one connection.")
+      .nargs(1)
+      .default_value(100)
+      .scan<'i', int>();
+  program.add_argument("--max-header-size")
+      .help("The maximum size of the request line and headers in bytes.")
+      .nargs(1)
+      .default_value(std::size_t(8192))
+      .scan<'u', std::size_t>();
+  program.add_argument("--max-body-size")
+      .help("The maximum size of a request body in bytes (0 = no limit).")
+      .nargs(1)
+      .default_value(std::size_t(64 << 20))
+      .scan<'u', std::size_t>();
+  program.add_argument("--no-sendfile")
+      .help("Read files into memory instead of sending them with sendfile.")
+      .flag();
+  program.add_argument("-u", "--io-uring")
+      .help("Serve with the io_uring backend (falls back to epoll).")
+      .flag();
+  program.add_argument("--max-connections")
+      .help("Clients served at once, more get a 503 (0 = no limit).")
+      .nargs(1)
+      .default_value(1000u)
+      .scan<'u', unsigned int>();
+  program.add_argument("--max-queued-requests")
+      .help("Requests waiting for their response, more get a 503 (0 = no "
+            "limit).")
+      .nargs(1)
+      .default_value(4096u)
+      .scan<'u', unsigned int>();
+  program.add_argument("--retry-after")
+      .help("Seconds a client that got a 503 is asked to wait.")
+      .nargs(1)
+      .default_value(1u)
+      .scan<'u', unsigned int>();
+  program.add_argument("--mime-types")
+      .help("A mime.types file adding to the built-in types, e.g. "
+            "/etc/mime.types.")
+      .nargs(1)
+      .default_value(std::string(""));
+  program.add_argument("--file-cache-size")
+      .help("The memory in bytes small files are cached in (0 = no cache).")
+      .nargs(1)
+      .default_value(std::size_t(64 << 20))
+      .scan<'u', std::size_t>();
+  program.add_argument("--file-cache-entry-size")
+      .help("The size in bytes up to which a file is cached.")
+      .nargs(1)
+      .default_value(std::size_t(1 << 20))
+      .scan<'u', std::size_t>();
+  program.add_argument("--mmap-budget")
+      .help("Send larger files from shared memory mappings of up to this many "
+            "bytes together instead of with sendfile (0 = no mappings).")
+      .nargs(1)
+      .default_value(std::size_t(0))
+      .scan<'u', std::size_t>();
+  program.add_argument("--compress")
+      .help("Compress cached text files on the fly for the clients taking "
+            "gzip (or zstd if built with ZSTD=1).")
+      .flag();
+  program.add_argument("--compression-threads")
+      .help("The workers compressing files in the background.")
+      .nargs(1)
+      .default_value(1u)
+      .scan<'u', unsigned int>();
+  program.add_argument("--compression-level")
+      .help("The compression level from 1 (fastest) to 9 (smallest).")
+      .nargs(1)
+      .default_value(6)
+      .scan<'i', int>();
+  program.add_argument("--compression-min-size")
+      .help("The size in bytes from which a file is compressed.")
+      .nargs(1)
+      .default_value(std::size_t(1024))
+      .scan<'u', std::size_t>();
+  program.add_argument("--compression-cache-size")
+      .help("The memory in bytes the compressed files are kept in.")
+      .nargs(1)
+      .default_value(std::size_t(16 << 20))
+      .scan<'u', std::size_t>();
 
   // Check if arguments where passed correctly
   try {
@@ -27,11 +127,56 @@ int main(int argc, char *argv[]) {
     std::exit(1);
   }
 
-  std::string ip_address = program.get<std::string>("ipaddress");
-  int port = program.get<int>("port");
+  ServerConfig config;
+  config.ip = program.get<std::string>("ipaddress");
+  config.port = program.get<int>("port");
+  config.threads = program.get<int>("threads");
+  config.reuseport = program.get<bool>("reuseport");
+  config.backlog = program.get<int>("backlog");
+  config.keep_alive_timeout = program.get<int>("keep-alive-timeout");
+  config.max_requests = program.get<int>("max-requests");
+  config.max_header_size = program.get<std::size_t>("max-header-size");
+  config.max_body_size = program.get<std::size_t>("max-body-size");
+  config.sendfile = !program.get<bool>("no-sendfile");
+  config.io_uring = program.get<bool>("io-uring");
+  config.max_connections = program.get<unsigned int>("max-connections");
+  config.max_queued_requests = program.get<unsigned int>("max-queued-requests");
+  config.retry_after = program.get<unsigned int>("retry-after");
+  config.mime_types_file = program.get<std::string>("mime-types");
+  config.file_cache_size = program.get<std::size_t>("file-cache-size");
+  config.file_cache_entry_size =
+      program.get<std::size_t>("file-cache-entry-size");
+  config.mmap_budget = program.get<std::size_t>("mmap-budget");
+  config.compression_threads =
+      program.get<bool>("compress")
+          ? program.get<unsigned int>("compression-threads")
+          : 0;
+  config.compression_level = program.get<int>("compression-level");
+  config.compression_min_size =
+      program.get<std::size_t>("compression-min-size");
+  config.compression_cache_size =
+      program.get<std::size_t>("compression-cache-size");
+
+  if (config.threads < 1) {
+    std::cerr << "The number of threads has to be at least 1\n";
+    std::exit(1);
+  }
+  if (config.compression_level < 1 || config.compression_level > 9) {
+    std::cerr << "The compression level has to be between 1 and 9\n";
+    std::exit(1);
+  }
+  if (config.backlog < 1) {
+    std::cerr << "The backlog has to be at least 1\n";
+    std::exit(1);
+  }
+  if (config.keep_alive_timeout < 0 || config.max_requests < 1) {
+    std::cerr << "The keep-alive timeout can't be negative and at least one "
+                 "request has to be served per connection\n";
+    std::exit(1);
+  }
 
   try {
-    Server server(ip_address, port);
+    Server server(config);
     server.run();
   } catch (const char *e) {
     std::cerr << "Server error: " << e << "\n";
@@ -0,0 +1,164 @@
+#include "mime_types.hpp"
+#include <fstream>
+#include <sstream>
+
+struct MimeEntry {
+  std::string_view extension;
+  std::string_view type;
+};
+
+// The types known without a mime.types file
+constexpr MimeEntry DEFAULT_MIME_TYPES[] = {
+    {"txt", "text/plain"},
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"css", "text/css"},
+    {"js", "application/javascript"},
+    {"mjs", "application/javascript"},
+    {"json", "application/json"},
+    {"xml", "text/xml"},
+    {"csv", "text/csv"},
+    {"md", "text/markdown"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"svg", "image/svg+xml"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"ico", "image/x-icon"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"otf", "font/otf"},
+    {"wasm", "application/wasm"},
+    {"pdf", "application/pdf"},
+    {"zip", "application/zip"},
+    {"gz", "application/gzip"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"mp3", "audio/mpeg"},
+    {"ogg", "audio/ogg"},
+    {"wav", "audio/wav"},
+};
+
+const std::string_view DEFAULT_MIME_TYPE = "application/octet-stream";
+const std::size_t INITIAL_SLOTS = 64;
+
+MimeRegistry::MimeRegistry() : slots(INITIAL_SLOTS) {
+  for (const MimeEntry &entry : DEFAULT_MIME_TYPES) {
+    this->insert(entry.extension, entry.type);
+  }
+}
+
+bool MimeRegistry::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    std::string::size_type comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+
+    std::istringstream words(line);
+    std::string type;
+    if (!(words >> type))
+      continue;
+    std::string_view interned_type = this->intern(type);
+
+    std::string extension;
+    while (words >> extension) {
+      if (extension.size() > MAX_EXTENSION_LENGTH)
+        continue;
+      for (char &c : extension) {
+        if (c >= 'A' && c <= 'Z')
+          c += 'a' - 'A';
+      }
+      this->insert(extension, interned_type);
+    }
+  }
+  return true;
+}
+
+std::string_view MimeRegistry::lookup(std::string_view path) const {
+  std::string_view::size_type dot = path.rfind('.');
+  if (dot == std::string_view::npos)
+    return DEFAULT_MIME_TYPE;
+  std::string_view extension = path.substr(dot + 1);
+  if (extension.empty() || extension.size() > MAX_EXTENSION_LENGTH ||
+      extension.find('/') != std::string_view::npos)
+    return DEFAULT_MIME_TYPE;
+
+  // Lowercased on the stack, the path itself stays untouched
+  char lower[MAX_EXTENSION_LENGTH];
+  for (std::size_t i = 0; i < extension.size(); ++i) {
+    char c = extension[i];
+    lower[i] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+  }
+  std::string_view key(lower, extension.size());
+
+  std::size_t mask = this->slots.size() - 1;
+  for (std::size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+    const Slot &slot = this->slots[i];
+    if (slot.length == 0)
+      return DEFAULT_MIME_TYPE;
+    if (std::string_view(slot.extension, slot.length) == key)
+      return slot.type;
+  }
+}
+
+std::size_t MimeRegistry::size() const { return this->count; }
+
+void MimeRegistry::insert(std::string_view extension, std::string_view type) {
+  if (extension.empty() || extension.size() > MAX_EXTENSION_LENGTH)
+    return;
+  // Kept at most half full, so probe sequences stay short
+  if ((this->count + 1) * 2 > this->slots.size())
+    this->grow();
+
+  std::size_t mask = this->slots.size() - 1;
+  for (std::size_t i = hash(extension) & mask;; i = (i + 1) & mask) {
+    Slot &slot = this->slots[i];
+    if (slot.length == 0) {
+      extension.copy(slot.extension, extension.size());
+      slot.length = extension.size();
+      slot.type = type;
+      ++this->count;
+      return;
+    }
+    if (std::string_view(slot.extension, slot.length) == extension) {
+      slot.type = type;
+      return;
+    }
+  }
+}
+
+std::string_view MimeRegistry::intern(std::string_view type) {
+  auto it = this->interned.find(type);
+  if (it == this->interned.end())
+    it = this->interned.emplace(type).first;
+  return *it;
+}
+
+void MimeRegistry::grow() {
+  std::vector<Slot> old(this->slots.size() * 2);
+  old.swap(this->slots);
+  this->count = 0;
+  for (const Slot &slot : old) {
+    if (slot.length != 0)
+      this->insert(std::string_view(slot.extension, slot.length), slot.type);
+  }
+}
+
+uint32_t MimeRegistry::hash(std::string_view extension) {
+  // FNV-1a, the keys are a handful of bytes
+  uint32_t value = 2166136261u;
+  for (char c : extension) {
+    value ^= static_cast<unsigned char>(c);
+    value *= 16777619u;
+  }
+  return value;
+}
@@ -0,0 +1,58 @@
+#ifndef MIME_TYPES_H
+#define MIME_TYPES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Maps file extensions to MIME types with a flat, open-addressing hash table.
+ * It starts out with a compiled-in table of the common types and can be
+ * extended with a mime.types file. The types are interned, a lookup hands out
+ * a view that lives as long as the registry and allocates nothing.
+ */
+class MimeRegistry {
+public:
+  MimeRegistry();
+
+  /*
+   * Adds the entries of a mime.types file ("type ext1 ext2 ...", '#' starts a
+   * comment), they take precedence over the compiled-in ones
+   * @return False if the file can't be read
+   */
+  bool load(const std::string &path);
+
+  /*
+   * @param path The path of the file, only its extension is looked at
+   * @return The type of the file or application/octet-stream if unknown
+   */
+  std::string_view lookup(std::string_view path) const;
+
+  std::size_t size() const;
+
+private:
+  static const std::size_t MAX_EXTENSION_LENGTH = 15;
+
+  struct Slot {
+    char extension[MAX_EXTENSION_LENGTH + 1] = {};
+    unsigned char length = 0; // 0 = empty slot
+    std::string_view type;
+  };
+
+  std::vector<Slot> slots; // The size is a power of two
+  std::size_t count = 0;
+  std::set<std::string, std::less<>> interned; // Types read from files
+
+  /*
+   * @param extension The lowercase extension without the dot
+   */
+  void insert(std::string_view extension, std::string_view type);
+  std::string_view intern(std::string_view type);
+  void grow();
+  static uint32_t hash(std::string_view extension);
+};
+
+#endif // !MIME_TYPES_H
@@ -0,0 +1,99 @@
+#include "recycler.hpp"
+#include <algorithm>
+#include <new>
+
+const std::size_t SIZE_CLASS = 64;
+const std::size_t SIZE_CLASSES = 64; // Blocks up to 4 KiB are recycled
+// The free blocks a size class keeps at most
+const std::size_t MAX_RECYCLED_BYTES = 64 << 10;
+const std::size_t MIN_RECYCLED_BLOCKS = 8;
+
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+/*
+ * The free lists of a thread, returned to the global allocator when the
+ * thread ends
+ */
+struct FreeLists {
+  FreeBlock *heads[SIZE_CLASSES] = {};
+  std::size_t counts[SIZE_CLASSES] = {};
+
+  ~FreeLists() {
+    for (FreeBlock *block : this->heads) {
+      while (block != nullptr) {
+        FreeBlock *next = block->next;
+        ::operator delete(block);
+        block = next;
+      }
+    }
+  }
+};
+
+thread_local FreeLists FREE_LISTS;
+
+std::size_t size_class(std::size_t size) {
+  return (size + SIZE_CLASS - 1) / SIZE_CLASS;
+}
+
+void *recycled_allocate(std::size_t size) {
+  std::size_t index = size_class(size);
+  if (index == 0 || index > SIZE_CLASSES)
+    return ::operator new(size);
+
+  FreeBlock *&head = FREE_LISTS.heads[index - 1];
+  if (head == nullptr)
+    return ::operator new(index * SIZE_CLASS);
+  FreeBlock *block = head;
+  head = block->next;
+  --FREE_LISTS.counts[index - 1];
+  return block;
+}
+
+void recycled_deallocate(void *block, std::size_t size) {
+  std::size_t index = size_class(size);
+  if (index == 0 || index > SIZE_CLASSES) {
+    ::operator delete(block);
+    return;
+  }
+
+  std::size_t limit = MAX_RECYCLED_BYTES / (index * SIZE_CLASS);
+  if (FREE_LISTS.counts[index - 1] >= std::max(limit, MIN_RECYCLED_BLOCKS)) {
+    ::operator delete(block);
+    return;
+  }
+  FreeBlock *free_block = static_cast<FreeBlock *>(block);
+  free_block->next = FREE_LISTS.heads[index - 1];
+  FREE_LISTS.heads[index - 1] = free_block;
+  ++FREE_LISTS.counts[index - 1];
+}
+
+/*
+ * Holds no state, so blocks may be freed by another thread than the one that
+ * allocated them
+ */
+class RecyclingResource : public std::pmr::memory_resource {
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      return ::operator new(bytes, std::align_val_t(alignment));
+    return recycled_allocate(bytes);
+  }
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override {
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      ::operator delete(p, std::align_val_t(alignment));
+      return;
+    }
+    recycled_deallocate(p, bytes);
+  }
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+};
+
+std::pmr::memory_resource *recycling_resource() {
+  static RecyclingResource resource;
+  return &resource;
+}
@@ -0,0 +1,23 @@
+#ifndef RECYCLER_H
+#define RECYCLER_H
+
+#include <cstddef>
+#include <memory_resource>
+
+/*
+ * Recycles the small blocks a thread allocates over and over for every
+ * request, the coroutine frames and the nodes of the response queues. Freed
+ * blocks go to a free list of their size class of the calling thread and are
+ * handed out again from there instead of the global allocator.
+ * @param size The size of the block, the same when it is freed again
+ */
+void *recycled_allocate(std::size_t size);
+void recycled_deallocate(void *block, std::size_t size);
+
+/*
+ * The recycling of the calling thread as a memory resource for the pmr
+ * containers
+ */
+std::pmr::memory_resource *recycling_resource();
+
+#endif // !RECYCLER_H
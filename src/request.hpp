@@ -0,0 +1,21 @@
+#ifndef REQUEST_H
+#define REQUEST_H
+
+#include "request_parser.hpp"
+#include <memory_resource>
+#include <string>
+
+/*
+ * A completely received request. Bodies that are too big to be kept in memory
+ * are spooled into a temporary file while they arrive.
+ */
+struct Request {
+  std::string head;      // The request line and headers incl. the empty line
+  RequestView view;      // The parsed head, points into head
+  std::string body;      // The body if it is kept in memory
+  int body_fd = -1; // The unnamed temporary file holding the body otherwise
+  // Where the request-scoped memory of its handling comes from
+  std::pmr::memory_resource *memory = std::pmr::get_default_resource();
+};
+
+#endif // !REQUEST_H
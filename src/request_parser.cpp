@@ -0,0 +1,325 @@
+#include "request_parser.hpp"
+#include "simd_scan.hpp"
+#include "string_utils.hpp"
+#include <algorithm>
+#include <iterator>
+
+// The characters of a method or header name (tchar of RFC 9110)
+bool is_token_char(unsigned char c) {
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+      (c >= '0' && c <= '9'))
+    return true;
+  switch (c) {
+  case '!':
+  case '#':
+  case '$':
+  case '%':
+  case '&':
+  case '\'':
+  case '*':
+  case '+':
+  case '-':
+  case '.':
+  case '^':
+  case '_':
+  case '`':
+  case '|':
+  case '~':
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool is_token(std::string_view value) {
+  if (value.empty())
+    return false;
+  for (unsigned char c : value) {
+    if (!is_token_char(c))
+      return false;
+  }
+  return true;
+}
+
+bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+KnownHeader classify_header(std::string_view name) {
+  // The length alone rules out all but one or two candidates
+  switch (name.size()) {
+  case 4:
+    if (iequals(name, "Host"))
+      return KnownHeader::HOST;
+    break;
+  case 5:
+    if (iequals(name, "Range"))
+      return KnownHeader::RANGE;
+    break;
+  case 6:
+    if (iequals(name, "Expect"))
+      return KnownHeader::EXPECT;
+    break;
+  case 10:
+    if (iequals(name, "Connection"))
+      return KnownHeader::CONNECTION;
+    break;
+  case 12:
+    if (iequals(name, "Content-Type"))
+      return KnownHeader::CONTENT_TYPE;
+    break;
+  case 13:
+    if (iequals(name, "If-None-Match"))
+      return KnownHeader::IF_NONE_MATCH;
+    break;
+  case 14:
+    if (iequals(name, "Content-Length"))
+      return KnownHeader::CONTENT_LENGTH;
+    break;
+  case 15:
+    if (iequals(name, "Append-Position"))
+      return KnownHeader::APPEND_POSITION;
+    if (iequals(name, "Accept-Encoding"))
+      return KnownHeader::ACCEPT_ENCODING;
+    break;
+  case 17:
+    if (iequals(name, "Transfer-Encoding"))
+      return KnownHeader::TRANSFER_ENCODING;
+    break;
+  }
+  return KnownHeader::COUNT;
+}
+
+bool parse_content_length(std::string_view value, std::size_t &length) {
+  if (value.empty() || value.size() > 19)
+    return false;
+  length = 0;
+  for (char c : value) {
+    if (c < '0' || c > '9')
+      return false;
+    length = length * 10 + (c - '0');
+  }
+  return true;
+}
+
+bool find_content_length(const RequestView &view,
+                         std::optional<std::size_t> &length) {
+  length.reset();
+  if (!view.header(KnownHeader::CONTENT_LENGTH))
+    return true;
+  for (std::size_t i = 0; i < view.header_count; ++i) {
+    if (!iequals(view.headers[i].name, "Content-Length"))
+      continue;
+    std::string_view list = view.headers[i].value;
+    while (true) {
+      std::string_view::size_type comma = list.find(',');
+      std::string_view item = list.substr(0, comma);
+      while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+        item.remove_prefix(1);
+      while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+        item.remove_suffix(1);
+      std::size_t value;
+      if (!parse_content_length(item, value) || (length && *length != value))
+        return false;
+      length = value;
+      if (comma == std::string_view::npos)
+        break;
+      list.remove_prefix(comma + 1);
+    }
+  }
+  return true;
+}
+
+std::optional<std::string_view>
+RequestView::header(KnownHeader name) const {
+  uint8_t slot = this->known[static_cast<std::size_t>(name)];
+  if (slot == 0)
+    return std::nullopt;
+  return this->headers[slot - 1].value;
+}
+
+std::optional<std::string_view>
+RequestView::header(std::string_view name) const {
+  for (std::size_t i = 0; i < this->header_count; ++i) {
+    if (iequals(this->headers[i].name, name))
+      return this->headers[i].value;
+  }
+  return std::nullopt;
+}
+
+ParseStatus RequestParser::parse(std::string_view data) {
+  if (this->state == State::DONE)
+    return ParseStatus::COMPLETE;
+  if (this->status != 0)
+    return ParseStatus::FAILED;
+
+  while (true) {
+    // One pass finds the line end, the colon of a header line and every
+    // control character that has no business in a head
+    bool colons = this->state == State::HEADER_LINE &&
+                  this->colon == std::string_view::npos;
+    std::size_t found =
+        this->scanned + scan_delimiter(data.data() + this->scanned,
+                                       data.size() - this->scanned, colons);
+    if (found == data.size()) {
+      this->scanned = found;
+      return ParseStatus::INCOMPLETE;
+    }
+    if (data[found] == ':') {
+      this->colon = found;
+      this->scanned = found + 1;
+      continue;
+    }
+
+    // Every line ends with CRLF, a bare LF or other control is malformed
+    if (data[found] != '\r')
+      return this->fail(400);
+    if (found + 1 == data.size()) {
+      this->scanned = found; // Look at the CR again with the LF
+      return ParseStatus::INCOMPLETE;
+    }
+    if (data[found + 1] != '\n')
+      return this->fail(400);
+
+    std::size_t offset = this->line_start;
+    std::string_view line = data.substr(offset, found - offset);
+    std::size_t colon = this->colon;
+    this->line_start = this->scanned = found + 2;
+    this->colon = std::string_view::npos;
+
+    if (this->state == State::REQUEST_LINE) {
+      // Empty lines in front of a request are ignored (RFC 9112 2.2)
+      if (line.empty())
+        continue;
+      if (!this->parse_request_line(line, offset))
+        return ParseStatus::FAILED;
+      this->state = State::HEADER_LINE;
+      continue;
+    }
+
+    if (line.empty()) {
+      this->state = State::DONE;
+      return ParseStatus::COMPLETE;
+    }
+    if (colon == std::string_view::npos)
+      return this->fail(400);
+    if (!this->parse_header_line(line, offset, colon - offset))
+      return ParseStatus::FAILED;
+  }
+}
+
+bool RequestParser::parse_request_line(std::string_view line,
+                                       std::size_t offset) {
+  // method SP request-target SP HTTP-version, separated by single spaces
+  std::size_t method_end = line.find(' ');
+  if (method_end == std::string_view::npos ||
+      !is_token(line.substr(0, method_end))) {
+    this->fail(400);
+    return false;
+  }
+  std::size_t target_start = method_end + 1;
+  std::size_t target_end = line.find(' ', target_start);
+  if (target_end == std::string_view::npos || target_end == target_start) {
+    this->fail(400);
+    return false;
+  }
+
+  // Only the origin form (and * for OPTIONS) addresses a file of this server
+  std::string_view target =
+      line.substr(target_start, target_end - target_start);
+  if (target[0] != '/' && target != "*") {
+    this->fail(400);
+    return false;
+  }
+  for (unsigned char c : target) {
+    if (c <= ' ' || c == 0x7f) {
+      this->fail(400);
+      return false;
+    }
+  }
+
+  std::string_view version = line.substr(target_end + 1);
+  if (version.size() != 8 || version.substr(0, 5) != "HTTP/" ||
+      !is_digit(version[5]) || version[6] != '.' || !is_digit(version[7])) {
+    this->fail(400);
+    return false;
+  }
+  if (version[5] != '1') {
+    this->fail(505);
+    return false;
+  }
+
+  this->method = {static_cast<uint32_t>(offset),
+                  static_cast<uint32_t>(method_end)};
+  this->target = {static_cast<uint32_t>(offset + target_start),
+                  static_cast<uint32_t>(target.size())};
+  this->version = {static_cast<uint32_t>(offset + target_end + 1), 8};
+  return true;
+}
+
+bool RequestParser::parse_header_line(std::string_view line,
+                                      std::size_t offset, std::size_t colon) {
+  // Obsolete line folding isn't supported (RFC 9112 5.2)
+  if (!is_token(line.substr(0, colon))) {
+    this->fail(400);
+    return false;
+  }
+  if (this->header_count == MAX_HEADERS) {
+    this->fail(431);
+    return false;
+  }
+
+  std::size_t value_start = colon + 1;
+  std::size_t value_end = line.size();
+  while (value_start < value_end &&
+         (line[value_start] == ' ' || line[value_start] == '\t'))
+    ++value_start;
+  while (value_end > value_start &&
+         (line[value_end - 1] == ' ' || line[value_end - 1] == '\t'))
+    --value_end;
+
+  this->names[this->header_count] = {static_cast<uint32_t>(offset),
+                                     static_cast<uint32_t>(colon)};
+  this->values[this->header_count] = {
+      static_cast<uint32_t>(offset + value_start),
+      static_cast<uint32_t>(value_end - value_start)};
+  ++this->header_count;
+  return true;
+}
+
+ParseStatus RequestParser::fail(unsigned int error_status) {
+  this->status = error_status;
+  return ParseStatus::FAILED;
+}
+
+std::size_t RequestParser::head_size() const {
+  return this->state == State::DONE ? this->line_start : 0;
+}
+
+unsigned int RequestParser::error_status() const { return this->status; }
+
+void RequestParser::view(std::string_view head, RequestView &request) const {
+  auto part = [head](Span span) {
+    return head.substr(span.begin, span.length);
+  };
+  request.method = part(this->method);
+  request.target = part(this->target);
+  request.version = part(this->version);
+  request.header_count = this->header_count;
+  std::fill(std::begin(request.known), std::end(request.known), 0);
+  for (std::size_t i = 0; i < this->header_count; ++i) {
+    request.headers[i].name = part(this->names[i]);
+    request.headers[i].value = part(this->values[i]);
+
+    KnownHeader known = classify_header(request.headers[i].name);
+    if (known == KnownHeader::COUNT)
+      continue;
+    uint8_t &slot = request.known[static_cast<std::size_t>(known)];
+    if (slot == 0)
+      slot = i + 1;
+  }
+}
+
+void RequestParser::reset() { *this = RequestParser(); }
+
+bool RequestParser::idle() const {
+  return this->state == State::REQUEST_LINE && this->scanned == 0;
+}
@@ -0,0 +1,153 @@
+#ifndef REQUEST_PARSER_H
+#define REQUEST_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// More header lines than this are rejected with 431
+const std::size_t MAX_HEADERS = 64;
+
+/*
+ * The headers the server looks at. They are classified once when the head is
+ * viewed, so looking them up needs no search.
+ */
+enum class KnownHeader : uint8_t {
+  CONTENT_LENGTH,
+  CONTENT_TYPE,
+  CONNECTION,
+  HOST,
+  EXPECT,
+  TRANSFER_ENCODING,
+  APPEND_POSITION,
+  IF_NONE_MATCH,
+  RANGE,
+  ACCEPT_ENCODING,
+  COUNT // Not a header, the number of known headers
+};
+
+/*
+ * @return The known header with the name (ignoring its case) or COUNT
+ */
+KnownHeader classify_header(std::string_view name);
+
+struct HeaderView {
+  std::string_view name;
+  std::string_view value; // Without the surrounding whitespace
+};
+
+/*
+ * A parsed request head as views into the bytes it was parsed from, which
+ * have to outlive the view
+ */
+struct RequestView {
+  std::string_view method;
+  std::string_view target;
+  std::string_view version;
+  HeaderView headers[MAX_HEADERS];
+  std::size_t header_count = 0;
+  // The index + 1 of the first header of each known name, 0 if it is missing
+  uint8_t known[static_cast<std::size_t>(KnownHeader::COUNT)] = {};
+
+  /*
+   * Looks a header up, ignoring the case of its name
+   * @return The value of the first header with the name, if there is one
+   */
+  std::optional<std::string_view> header(std::string_view name) const;
+  std::optional<std::string_view> header(KnownHeader name) const;
+};
+
+/*
+ * Accepts the plain decimal digits RFC 9110 allows, without overflowing
+ */
+bool parse_content_length(std::string_view value, std::size_t &length);
+
+/*
+ * Finds the length every Content-Length header (and every item of a comma
+ * list in one) agrees on. Differing or malformed values are rejected, a
+ * proxy in front could frame the body differently (RFC 9112 6.3).
+ * @param length Set to the length, nullopt without a Content-Length header
+ * @return False if the values are malformed or differ
+ */
+bool find_content_length(const RequestView &view,
+                         std::optional<std::size_t> &length);
+
+enum class ParseStatus { INCOMPLETE, COMPLETE, FAILED };
+
+/*
+ * A single-pass parser for the request line and the headers. It remembers
+ * where it stopped, so every call only looks at the bytes that arrived since
+ * the last one, and allocates nothing. The bytes are scanned with the
+ * vectorized scan_delimiter.
+ */
+class RequestParser {
+public:
+  /*
+   * Continues parsing the head of a request
+   * @param data All bytes received for the request so far, starting with the
+   * request line (the parsed prefix must not change between calls)
+   * @return COMPLETE once the empty line ending the head was parsed, FAILED
+   * if the head is malformed (see error_status)
+   */
+  ParseStatus parse(std::string_view data);
+
+  /*
+   * The size of the head including the empty line, once it is complete
+   */
+  std::size_t head_size() const;
+
+  /*
+   * The status a failed request has to be answered with
+   */
+  unsigned int error_status() const;
+
+  /*
+   * The parsed request with views into the given bytes
+   * @param head The complete head (or a copy of it) the parser saw
+   */
+  void view(std::string_view head, RequestView &request) const;
+
+  /*
+   * Prepares the parser for the next request
+   */
+  void reset();
+
+  /*
+   * @return True if the parser hasn't seen a byte of the next request yet
+   */
+  bool idle() const;
+
+private:
+  // A part of the head by its position, views would dangle once the receive
+  // buffer grows
+  struct Span {
+    uint32_t begin = 0;
+    uint32_t length = 0;
+  };
+
+  enum class State { REQUEST_LINE, HEADER_LINE, DONE };
+
+  State state = State::REQUEST_LINE;
+  std::size_t line_start = 0; // Where the line being parsed starts
+  std::size_t scanned = 0;    // Bytes of it already scanned
+  // The colon of the header line being parsed, once it was found
+  std::size_t colon = std::string_view::npos;
+  unsigned int status = 0;
+  Span method;
+  Span target;
+  Span version;
+  Span names[MAX_HEADERS];
+  Span values[MAX_HEADERS];
+  std::size_t header_count = 0;
+
+  bool parse_request_line(std::string_view line, std::size_t offset);
+  /*
+   * @param colon The position of the first colon in the line
+   */
+  bool parse_header_line(std::string_view line, std::size_t offset,
+                         std::size_t colon);
+  ParseStatus fail(unsigned int error_status);
+};
+
+#endif // !REQUEST_PARSER_H
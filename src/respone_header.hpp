@@ -1,78 +1,175 @@
 #ifndef RESPONSE_HEADER_H
 #define RESPONSE_HEADER_H
 
-#include <map>
+#include <array>
+#include <cstddef>
+#include <string_view>
 
-const std::map<unsigned int, std::string> RESPONSES{
-    {100, "100 Continue"},
-    {101, "101 Switching Protocols"},
-    {102, "102 Processing"},
-    {200, "200 OK"},
-    {201, "201 Created"},
-    {202, "202 Accepted"},
-    {203, "203 Non-Authoritative Information"},
-    {204, "204 No Content"},
-    {205, "205 Reset Content"},
-    {206, "206 Partial Content"},
-    {207, "207 Multi-Status"},
-    {208, "208 Already Reported"},
-    {226, "226 IM Used"},
-    {300, "300 Multiple Choices"},
-    {301, "301 Moved Permanently"},
-    {302, "302 Found"},
-    {303, "303 See Other"},
-    {304, "304 Not Modified"},
-    {305, "305 Use Proxy"},
-    {307, "307 Temporary Redirect"},
-    {308, "308 Permanent Redirect"},
-    {400, "400 Bad Request"},
-    {401, "401 Unauthorized"},
-    {402, "402 Payment Required"},
-    {403, "403 Forbidden"},
-    {404, "404 Not Found"},
-    {405, "405 Method Not Allowed"},
-    {406, "406 Not Acceptable"},
-    {407, "407 Proxy Authentication Required"},
-    {408, "408 Request Timeout"},
-    {409, "409 Conflict"},
-    {410, "410 Gone"},
-    {411, "411 Length Required"},
-    {412, "412 Precondition Failed"},
-    {413, "413 Payload Too Large"},
-    {414, "414 URI Too Long"},
-    {415, "415 Unsupported Media Type"},
-    {416, "416 Range Not Satisfiable"},
-    {417, "417 Expectation Failed"},
-    {418, "418 I'm a teapot"},
-    {421, "421 Misdirected Request"},
-    {422, "422 Unprocessable Entity"},
-    {423, "423 Locked"},
-    {424, "424 Failed Dependency"},
-    {425, "425 Too Early"},
-    {426, "426 Upgrade Required"},
-    {428, "428 Precondition Required"},
-    {429, "429 Too Many Requests"},
-    {431, "431 Request Header Fields Too Large"},
-    {451, "451 Unavailable For Legal Reasons"},
-    {500, "500 Internal Server Error"},
-    {501, "501 Not Implemented"},
-    {502, "502 Bad Gateway"},
-    {503, "503 Service Unavailable"},
-    {504, "504 Gateway Timeout"},
-    {505, "505 HTTP Version Not Supported"},
-    {506, "506 Variant Also Negotiates"},
-    {507, "507 Insufficient Storage"},
-    {508, "508 Loop Detected"},
-    {510, "510 Not Extended"},
-    {511, "511 Network Authentication Required"}};
+// The complete status line of every known response code
+constexpr std::string_view STATUS_LINE_LIST[] = {
+    "HTTP/1.1 100 Continue\r\n",
+    "HTTP/1.1 101 Switching Protocols\r\n",
+    "HTTP/1.1 102 Processing\r\n",
+    "HTTP/1.1 200 OK\r\n",
+    "HTTP/1.1 201 Created\r\n",
+    "HTTP/1.1 202 Accepted\r\n",
+    "HTTP/1.1 203 Non-Authoritative Information\r\n",
+    "HTTP/1.1 204 No Content\r\n",
+    "HTTP/1.1 205 Reset Content\r\n",
+    "HTTP/1.1 206 Partial Content\r\n",
+    "HTTP/1.1 207 Multi-Status\r\n",
+    "HTTP/1.1 208 Already Reported\r\n",
+    "HTTP/1.1 226 IM Used\r\n",
+    "HTTP/1.1 300 Multiple Choices\r\n",
+    "HTTP/1.1 301 Moved Permanently\r\n",
+    "HTTP/1.1 302 Found\r\n",
+    "HTTP/1.1 303 See Other\r\n",
+    "HTTP/1.1 304 Not Modified\r\n",
+    "HTTP/1.1 305 Use Proxy\r\n",
+    "HTTP/1.1 307 Temporary Redirect\r\n",
+    "HTTP/1.1 308 Permanent Redirect\r\n",
+    "HTTP/1.1 400 Bad Request\r\n",
+    "HTTP/1.1 401 Unauthorized\r\n",
+    "HTTP/1.1 402 Payment Required\r\n",
+    "HTTP/1.1 403 Forbidden\r\n",
+    "HTTP/1.1 404 Not Found\r\n",
+    "HTTP/1.1 405 Method Not Allowed\r\n",
+    "HTTP/1.1 406 Not Acceptable\r\n",
+    "HTTP/1.1 407 Proxy Authentication Required\r\n",
+    "HTTP/1.1 408 Request Timeout\r\n",
+    "HTTP/1.1 409 Conflict\r\n",
+    "HTTP/1.1 410 Gone\r\n",
+    "HTTP/1.1 411 Length Required\r\n",
+    "HTTP/1.1 412 Precondition Failed\r\n",
+    "HTTP/1.1 413 Payload Too Large\r\n",
+    "HTTP/1.1 414 URI Too Long\r\n",
+    "HTTP/1.1 415 Unsupported Media Type\r\n",
+    "HTTP/1.1 416 Range Not Satisfiable\r\n",
+    "HTTP/1.1 417 Expectation Failed\r\n",
+    "HTTP/1.1 418 I'm a teapot\r\n",
+    "HTTP/1.1 421 Misdirected Request\r\n",
+    "HTTP/1.1 422 Unprocessable Entity\r\n",
+    "HTTP/1.1 423 Locked\r\n",
+    "HTTP/1.1 424 Failed Dependency\r\n",
+    "HTTP/1.1 425 Too Early\r\n",
+    "HTTP/1.1 426 Upgrade Required\r\n",
+    "HTTP/1.1 428 Precondition Required\r\n",
+    "HTTP/1.1 429 Too Many Requests\r\n",
+    "HTTP/1.1 431 Request Header Fields Too Large\r\n",
+    "HTTP/1.1 451 Unavailable For Legal Reasons\r\n",
+    "HTTP/1.1 500 Internal Server Error\r\n",
+    "HTTP/1.1 501 Not Implemented\r\n",
+    "HTTP/1.1 502 Bad Gateway\r\n",
+    "HTTP/1.1 503 Service Unavailable\r\n",
+    "HTTP/1.1 504 Gateway Timeout\r\n",
+    "HTTP/1.1 505 HTTP Version Not Supported\r\n",
+    "HTTP/1.1 506 Variant Also Negotiates\r\n",
+    "HTTP/1.1 507 Insufficient Storage\r\n",
+    "HTTP/1.1 508 Loop Detected\r\n",
+    "HTTP/1.1 510 Not Extended\r\n",
+    "HTTP/1.1 511 Network Authentication Required\r\n",
+};
 
-inline std::string get_response(const unsigned int &response_code) {
-  try {
-    return RESPONSES.at(response_code);
-  } catch (const std::out_of_range &) {
-    static const std::string default_response = "Unknown response code";
-    return default_response;
+const unsigned int MIN_STATUS_CODE = 100;
+const unsigned int MAX_STATUS_CODE = 599;
+
+/*
+ * Places each status line at the index of its code, the code is read from
+ * the line itself
+ */
+constexpr std::array<std::string_view, MAX_STATUS_CODE + 1>
+index_status_lines() {
+  std::array<std::string_view, MAX_STATUS_CODE + 1> table{};
+  for (std::string_view line : STATUS_LINE_LIST) {
+    unsigned int code = (line[9] - '0') * 100 + (line[10] - '0') * 10 +
+                        (line[11] - '0');
+    table[code] = line;
+  }
+  return table;
+}
+
+constexpr std::array<std::string_view, MAX_STATUS_CODE + 1> STATUS_LINES =
+    index_status_lines();
+
+/*
+ * Returns the status line "HTTP/1.1 <code> <reason>\r\n" of a response code,
+ * unknown codes are answered as 500. The lines are static, so responses can
+ * reference them.
+ */
+constexpr std::string_view get_status_line(unsigned int response_code) {
+  if (response_code < MIN_STATUS_CODE || response_code > MAX_STATUS_CODE ||
+      STATUS_LINES[response_code].empty()) {
+    return STATUS_LINES[500];
   }
+  return STATUS_LINES[response_code];
 }
 
+/*
+ * A response head rendered at compile time: the status line and, if there is
+ * a body, its Content-Type and Content-Length. Only the per-connection headers
+ * are added to it at runtime.
+ */
+struct StaticHead {
+  char data[128] = {};
+  std::size_t length = 0;
+
+  constexpr void append(std::string_view text) {
+    for (char c : text)
+      this->data[this->length++] = c;
+  }
+  constexpr std::string_view view() const {
+    return std::string_view(this->data, this->length);
+  }
+};
+
+constexpr StaticHead render_head(unsigned int response_code,
+                                 std::string_view content_type,
+                                 std::size_t content_length) {
+  StaticHead head;
+  head.append(get_status_line(response_code));
+  if (content_length != 0) {
+    head.append("Content-Type: ");
+    head.append(content_type);
+    head.append("\r\n");
+  }
+  if (response_code != 204 && response_code != 304) {
+    char digits[20];
+    std::size_t count = 0;
+    do {
+      digits[count++] = '0' + content_length % 10;
+      content_length /= 10;
+    } while (content_length > 0);
+    head.append("Content-Length: ");
+    while (count > 0)
+      head.append(std::string_view(&digits[--count], 1));
+    head.append("\r\n");
+  }
+  return head;
+}
+
+/*
+ * A response that never changes, sent from static bytes
+ */
+struct FixedResponse {
+  std::string_view head;
+  std::string_view body;
+};
+
+constexpr std::string_view NOT_FOUND_BODY =
+    "<html><body><h1>404 Not Found</h1></body></html>";
+constexpr std::string_view FORBIDDEN_BODY =
+    "The file is not contained in the server's whitelist";
+
+constexpr StaticHead NO_CONTENT_HEAD = render_head(204, "", 0);
+constexpr StaticHead NOT_FOUND_HEAD =
+    render_head(404, "text/html", NOT_FOUND_BODY.size());
+constexpr StaticHead FORBIDDEN_HEAD =
+    render_head(403, "text/html", FORBIDDEN_BODY.size());
+constexpr StaticHead NOT_IMPLEMENTED_HEAD = render_head(501, "", 0);
+
+constexpr FixedResponse NO_CONTENT{NO_CONTENT_HEAD.view(), ""};
+constexpr FixedResponse NOT_FOUND{NOT_FOUND_HEAD.view(), NOT_FOUND_BODY};
+constexpr FixedResponse FORBIDDEN{FORBIDDEN_HEAD.view(), FORBIDDEN_BODY};
+constexpr FixedResponse NOT_IMPLEMENTED{NOT_IMPLEMENTED_HEAD.view(), ""};
+
 #endif // !RESPONSE_HEADER_H
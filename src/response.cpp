@@ -0,0 +1,223 @@
+#include "response.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+#include <utility>
+
+// Room for the usual header lines without growing the buffer
+const std::size_t HEADER_BUFFER_SIZE = 512;
+const std::string_view HEAD_END = "\r\n";
+
+Response::Response(std::string_view status_line,
+                   std::pmr::memory_resource *memory)
+    : status_line(status_line), resource(memory) {}
+
+Response::Response(Response &&other) noexcept
+    : status_line(other.status_line), body(other.body),
+      file_fd(other.file_fd), file_offset(other.file_offset),
+      file_length(other.file_length), transfer(other.transfer),
+      resource(other.resource),
+      headers(std::exchange(other.headers, Buffer())),
+      loaded(std::exchange(other.loaded, Buffer())),
+      body_owner(std::move(other.body_owner)),
+      mapping(std::exchange(other.mapping, nullptr)),
+      complete_head(other.complete_head) {
+  other.file_fd = -1;
+  other.file_length = 0;
+}
+
+Response &Response::operator=(Response &&other) noexcept {
+  if (this != &other) {
+    this->close_file();
+    this->release(this->headers);
+    this->release(this->loaded);
+    this->status_line = other.status_line;
+    this->body = other.body;
+    this->file_fd = other.file_fd;
+    this->file_offset = other.file_offset;
+    this->file_length = other.file_length;
+    this->transfer = other.transfer;
+    this->resource = other.resource;
+    this->headers = std::exchange(other.headers, Buffer());
+    this->loaded = std::exchange(other.loaded, Buffer());
+    this->body_owner = std::move(other.body_owner);
+    this->mapping = std::exchange(other.mapping, nullptr);
+    this->complete_head = other.complete_head;
+    other.file_fd = -1;
+    other.file_length = 0;
+  }
+  return *this;
+}
+
+Response::~Response() {
+  this->close_file();
+  this->release(this->headers);
+  this->release(this->loaded);
+}
+
+Response Response::prerendered(std::string_view head) {
+  Response response(head);
+  response.complete_head = true;
+  return response;
+}
+
+std::pmr::memory_resource *Response::memory() const { return this->resource; }
+
+void Response::add_header(std::string_view name, std::string_view value) {
+  Buffer &buffer = this->headers;
+  std::size_t length = name.size() + value.size() + 4;
+  if (buffer.size + length > buffer.capacity) {
+    std::size_t capacity = std::max(buffer.capacity * 2, HEADER_BUFFER_SIZE);
+    while (capacity < buffer.size + length)
+      capacity *= 2;
+    char *data = static_cast<char *>(this->resource->allocate(capacity, 1));
+    if (buffer.size > 0)
+      memcpy(data, buffer.data, buffer.size);
+    std::size_t size = buffer.size;
+    this->release(buffer);
+    buffer.data = data;
+    buffer.size = size;
+    buffer.capacity = capacity;
+  }
+
+  char *out = buffer.data + buffer.size;
+  out = std::copy(name.begin(), name.end(), out);
+  *out++ = ':';
+  *out++ = ' ';
+  out = std::copy(value.begin(), value.end(), out);
+  *out++ = '\r';
+  *out++ = '\n';
+  buffer.size += length;
+}
+
+void Response::add_header(std::string_view name, std::size_t value) {
+  char digits[20];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  this->add_header(name, std::string_view(digits, result.ptr - digits));
+}
+
+void Response::set_body(std::string_view body) {
+  this->body_owner.reset();
+  this->mapping = nullptr;
+  this->body = body;
+}
+
+void Response::set_body(std::shared_ptr<const std::string> body) {
+  this->body = *body;
+  this->body_owner = std::move(body);
+  this->mapping = nullptr;
+}
+
+void Response::set_body(std::shared_ptr<const FileMapping> mapping) {
+  this->body = std::string_view(mapping->data, mapping->size);
+  this->mapping = mapping.get();
+  this->body_owner = std::move(mapping);
+}
+
+bool Response::body_intact() const {
+  return this->mapping == nullptr || this->mapping->intact();
+}
+
+void Response::attach_file(int fd, std::size_t length,
+                           FileTransfer transfer) {
+  this->close_file();
+  this->file_fd = fd;
+  this->file_offset = 0;
+  this->file_length = length;
+  this->transfer = transfer;
+}
+
+bool Response::has_file() const {
+  if (this->file_fd < 0)
+    return false;
+  // Without a length the file is sent until it ends
+  return this->file_length > 0 || this->transfer == FileTransfer::CHUNKED ||
+         this->transfer == FileTransfer::UNTIL_CLOSE;
+}
+
+bool Response::load_file() {
+  std::size_t old_size = this->body.size();
+  std::size_t capacity = old_size + this->file_length;
+  char *data = static_cast<char *>(this->resource->allocate(capacity, 1));
+  if (old_size > 0)
+    memcpy(data, this->body.data(), old_size);
+
+  std::size_t loaded = 0;
+  while (loaded < this->file_length) {
+    ssize_t result = pread(this->file_fd, data + old_size + loaded,
+                           this->file_length - loaded, this->file_offset);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result <= 0) {
+      this->resource->deallocate(data, capacity, 1);
+      return false;
+    }
+    loaded += result;
+    this->file_offset += result;
+  }
+
+  this->release(this->loaded);
+  this->loaded.data = data;
+  this->loaded.size = capacity;
+  this->loaded.capacity = capacity;
+  this->set_body(std::string_view(data, capacity));
+  this->close_file();
+  return true;
+}
+
+void Response::release(Buffer &buffer) {
+  if (buffer.data != nullptr) {
+    this->resource->deallocate(buffer.data, buffer.capacity, 1);
+  }
+  buffer = Buffer();
+}
+
+std::string_view Response::header_lines() const {
+  return std::string_view(this->headers.data, this->headers.size);
+}
+
+void Response::close_file() {
+  if (this->file_fd >= 0) {
+    close(this->file_fd);
+  }
+  this->file_fd = -1;
+  this->file_length = 0;
+}
+
+void Response::drop_body() {
+  this->close_file();
+  this->transfer = FileTransfer::KERNEL;
+  this->release(this->loaded);
+  this->body_owner.reset();
+  this->mapping = nullptr;
+  this->body = std::string_view();
+}
+
+std::size_t Response::size() const {
+  std::size_t head_end = this->complete_head ? 0 : HEAD_END.size();
+  return this->status_line.size() + this->headers.size + head_end +
+         this->body.size();
+}
+
+std::size_t Response::gather(iovec *iov, std::size_t max,
+                             std::size_t offset) const {
+  std::string_view segments[] = {this->status_line, this->header_lines(),
+                                 this->complete_head ? "" : HEAD_END,
+                                 this->body};
+  std::size_t count = 0;
+  for (std::string_view segment : segments) {
+    if (offset >= segment.size()) {
+      offset -= segment.size();
+      continue;
+    }
+    if (count == max)
+      break;
+    iov[count].iov_base = const_cast<char *>(segment.data()) + offset;
+    iov[count].iov_len = segment.size() - offset;
+    offset = 0;
+    ++count;
+  }
+  return count;
+}
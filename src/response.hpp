@@ -0,0 +1,153 @@
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include "file_mappings.hpp"
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * How the file of a response gets to the client
+ */
+enum class FileTransfer {
+  KERNEL,     // file_length bytes by the transport, without copies if it can
+  BLOCKS,     // file_length bytes read and sent block by block
+  CHUNKED,    // Block by block in chunked coding until the file ends
+  UNTIL_CLOSE // Block by block until the file ends, closing the connection
+};
+
+/*
+ * A response on its way to the client, kept as separate segments that are
+ * sent with one gathering write: the status line, the header lines, the
+ * empty line and the body, followed by the open file, which the kernel moves
+ * to the socket with sendfile where it can or which is streamed block by
+ * block otherwise. Nothing is concatenated: the status line and the body
+ * are referenced, only the header lines (and bodies read from files) are
+ * written into buffers, which come from the memory resource of the response,
+ * usually the arena of the connection.
+ */
+class Response {
+public:
+  Response() = default;
+  /*
+   * @param status_line The status line incl. CRLF (maybe followed by more
+   * static header lines), it has to outlive the response
+   * @param memory Where the buffers of the response are allocated
+   */
+  explicit Response(
+      std::string_view status_line,
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+  Response(Response &&other) noexcept;
+  Response &operator=(Response &&other) noexcept;
+  Response(const Response &) = delete;
+  Response &operator=(const Response &) = delete;
+  ~Response();
+
+  /*
+   * A response whose complete head (status line, headers and empty line) was
+   * rendered ahead of time and can't take further headers
+   * @param head The rendered head, it has to outlive the response
+   */
+  static Response prerendered(std::string_view head);
+
+  /*
+   * Where the buffers of the response are allocated
+   */
+  std::pmr::memory_resource *memory() const;
+
+  void add_header(std::string_view name, std::string_view value);
+  void add_header(std::string_view name, std::size_t value);
+
+  /*
+   * Sets a body that is only referenced, e.g. a literal
+   */
+  void set_body(std::string_view body);
+  /*
+   * Sets a body the response keeps alive
+   */
+  void set_body(std::shared_ptr<const std::string> body);
+  /*
+   * Sets a mapped file as the body, the response keeps the mapping alive
+   */
+  void set_body(std::shared_ptr<const FileMapping> mapping);
+  /*
+   * False if the body is mapped from a file that got truncated since, the
+   * missing pages can't be sent
+   */
+  bool body_intact() const;
+
+  /*
+   * Attaches a file as the body of the response, the response owns it
+   * afterwards
+   * @param fd The open file
+   * @param length The number of bytes to send from the start of the file,
+   * ignored for the transfers that send until the end of the file
+   * @param transfer How the file is sent
+   */
+  void attach_file(int fd, std::size_t length,
+                   FileTransfer transfer = FileTransfer::KERNEL);
+  /*
+   * True while file content still has to be sent after the bytes in memory
+   */
+  bool has_file() const;
+
+  /*
+   * Replaces the file body with its content read into the body, for small
+   * files that are cheaper to send together with the head
+   * @return True if the remaining file content could be read
+   */
+  bool load_file();
+  void close_file();
+  /*
+   * Drops the body and the file but keeps the head, whose Content-Length
+   * still describes them (the response to a HEAD request)
+   */
+  void drop_body();
+
+  /*
+   * The number of bytes in memory (everything but the file)
+   */
+  std::size_t size() const;
+
+  /*
+   * Describes the bytes in memory from offset on as buffers for writev
+   * @param iov Where to put the buffers
+   * @param max The number of buffers iov has room for
+   * @param offset The number of bytes already sent
+   * @return The number of buffers used
+   */
+  std::size_t gather(iovec *iov, std::size_t max, std::size_t offset) const;
+
+  std::string_view status_line;
+  std::string_view body;
+  int file_fd = -1;
+  off_t file_offset = 0;
+  std::size_t file_length = 0; // File bytes that still have to be sent
+  FileTransfer transfer = FileTransfer::KERNEL;
+
+private:
+  /*
+   * A buffer allocated from the memory resource of the response
+   */
+  struct Buffer {
+    char *data = nullptr;
+    std::size_t size = 0;
+    std::size_t capacity = 0;
+  };
+
+  std::pmr::memory_resource *resource = std::pmr::get_default_resource();
+  Buffer headers; // The header lines, each ending with CRLF
+  Buffer loaded;  // A file body read into memory
+  std::shared_ptr<const void> body_owner; // Keeps the body alive
+  const FileMapping *mapping = nullptr;   // The owner if the body is mapped
+  bool complete_head = false; // The status line is the complete head
+
+  void release(Buffer &buffer);
+  std::string_view header_lines() const;
+};
+
+#endif // !RESPONSE_H
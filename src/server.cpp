@@ -1,292 +1,527 @@
+#include "server.hpp"
 #include "auth.hpp"
+#include "event_loop.hpp"
+#include "file_cache.hpp"
 #include "file_append.hpp"
+#include "http_date.hpp"
 #include "respone_header.hpp"
+#include "simd_scan.hpp"
+#include "string_utils.hpp"
+#include "uring_loop.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <charconv>
+#include <csignal>
 #include <cstddef>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <netinet/in.h>
-#include <sstream>
+#include <optional>
+#include <poll.h>
+#include <pthread.h>
+#include <string_view>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 
-// NOTE: Some helper functions
-
-bool ends_with(const std::string &value, const std::string &suffix) {
-  if (suffix.size() > value.size())
-    return false;
-  return std::equal(suffix.rbegin(), suffix.rend(), value.rbegin());
-}
+// NOTE: Start of the server class
 
-std::string to_lower(const std::string &str) {
-  std::string lower_str = str;
-  std::transform(lower_str.begin(), lower_str.end(), lower_str.begin(),
-                 [](unsigned char c) { return std::tolower(c); });
-  return lower_str;
+std::vector<int> Server::SERVER_SOCKETS;
+AdmissionControl Server::ADMISSION;
+// Destroyed after the cache, whose watcher thread drops mappings until it
+// is joined
+FileMappings Server::FILE_MAPPINGS;
+FileCache Server::FILE_CACHE;
+Compressor Server::COMPRESSOR;
+
+// Serializes the requests that modify files when running with several workers
+std::mutex FILE_WRITE_MUTEX;
+
+// Files smaller than this are read into the response instead of sendfile'd
+const std::size_t SENDFILE_MIN_SIZE = 16 << 10;
+
+// Appends the target without empty and "." segments, so a file is always
+// reached by the same path (which keys its cache entry). Fails on ".."
+// segments, which could leave the served directory.
+bool append_normalized(std::pmr::string &path, std::string_view target) {
+  std::size_t start = 0;
+  while (start < target.size()) {
+    std::size_t end = target.find('/', start);
+    if (end == std::string_view::npos)
+      end = target.size();
+    std::string_view segment = target.substr(start, end - start);
+    if (segment == "..")
+      return false;
+    if (!segment.empty() && segment != ".") {
+      path.push_back('/');
+      path.append(segment);
+    }
+    start = end + 1;
+  }
+  return true;
 }
 
-std::string trim(const std::string &str) {
-  const char *whitespace = " \t\n\r\f\v";
-  std::string trimmed = str;
-  trimmed.erase(trimmed.find_last_not_of(whitespace) + 1);
-  trimmed.erase(0, trimmed.find_first_not_of(whitespace));
-  return trimmed;
+// Tells which coding the body is in and that the client's Accept-Encoding
+// picked it
+void add_coding_headers(Response &res, ContentCoding coding, bool vary) {
+  if (coding != ContentCoding::IDENTITY) {
+    res.add_header("Content-Encoding", coding_name(coding));
+  }
+  if (vary) {
+    res.add_header("Vary", "Accept-Encoding");
+  }
 }
 
-// NOTE: Start of the server class
+void Server::handle_signals(sigset_t signals) {
+  while (true) {
+    int signal;
+    if (sigwait(&signals, &signal) != 0)
+      continue;
+    std::cout << "[STATS] Serving " << ADMISSION.connections()
+              << " connections with " << ADMISSION.queued()
+              << " queued requests\n";
+    std::cout << "[STATS] Shed " << ADMISSION.shed_connections()
+              << " connections and " << ADMISSION.shed_requests()
+              << " requests\n";
+    std::cout << "[STATS] File cache: " << FILE_CACHE.hits() << " hits, "
+              << FILE_CACHE.misses() << " misses, "
+              << FILE_CACHE.uncacheable() << " uncacheable\n";
+    if (signal != SIGINT)
+      continue;
 
-class Server {
-public:
-  Server(const std::string &ip, int port);
-  Server(Server &&) = default;
-  Server(const Server &) = default;
-  Server &operator=(Server &&) = default;
-  Server &operator=(const Server &) = default;
-  ~Server();
-  static void signal_handler(int signal);
-  void run();
-
-private:
-  static int SERVER_SOCKET;
-  void bind_server(const std::string &ip, int port);
-  std::string generate_response(const unsigned int &status,
-                                const std::string &content = "",
-                                const std::string &content_type = "text/html");
-  std::string get_content_type(const std::string &path);
-  std::unordered_map<std::string, std::string>
-  parse_headers(const std::string &req);
-  std::pair<int, int> get_append_position(const std::string &body);
-  std::string evaluate_request(const std::string &req);
-  std::string get_request(const std::string &path);
-  std::string post_request(const std::string &req, const std::string &path);
-  std::string put_request(const std::string &req, const std::string &path);
-  std::string delete_request(const std::string &path);
-  std::string head_request(const std::string &path);
-};
-
-int Server::SERVER_SOCKET = -1;
-
-void Server::signal_handler(int signal) {
-  if (signal == SIGINT) {
     std::cout << "[INFO] Shutting down server...\n";
-    if (SERVER_SOCKET > 0) {
-      close(SERVER_SOCKET);
+    this->stopping = true;
+    uint64_t one = 1;
+    if (write(this->stop_fd, &one, sizeof(one)) < 0) {
+      std::cerr << "[ERROR] Failed to stop the event loops. errno: " << errno
+                << " (" << strerror(errno) << ")\n";
     }
-    exit(0);
+    return;
   }
 }
 
-Server::Server(const std::string &ip, int port) {
-  this->SERVER_SOCKET = socket(AF_INET, SOCK_STREAM, 0);
-  if (this->SERVER_SOCKET < 0) {
-    std::cerr << "[ERROR] Creation of server socket failed. errno: " << errno
-              << " (" << strerror(errno) << ")\n";
-    throw "[SERVER] Failed to created server socket\n";
+Server::Server(const ServerConfig &config) : config(config) {
+  this->ADMISSION.configure(config.max_connections, config.max_queued_requests,
+                            config.retry_after);
+  // Before the cache starts the watcher that reports to the mappings
+  this->FILE_MAPPINGS.configure(config.mmap_budget, this->FILE_CACHE);
+  this->FILE_CACHE.configure(config.file_cache_size,
+                             config.file_cache_entry_size);
+  // Only cached files are compressed
+  if (config.file_cache_size > 0) {
+    this->COMPRESSOR.configure(
+        config.compression_threads, config.compression_level,
+        config.compression_min_size, config.compression_cache_size);
   }
+  refresh_http_date();
 
-  try {
-    this->bind_server(ip, port);
-  } catch (const char *e) {
-    throw e;
+  if (!config.mime_types_file.empty()) {
+    if (!this->mime_types.load(config.mime_types_file)) {
+      throw "[SERVER] Can't read the MIME types file\n";
+    }
+    std::cout << "[SERVER] Loaded " << this->mime_types.size()
+              << " MIME types\n";
   }
+
+  // In sharded mode every worker gets its own SO_REUSEPORT listener
+  int listeners = config.reuseport ? std::max(config.threads, 1) : 1;
+
+  for (int i = 0; i < listeners; ++i) {
+    try {
+      this->SERVER_SOCKETS.push_back(
+          this->bind_server(config.ip, config.port));
+    } catch (const char *e) {
+      throw e;
+    }
+  }
+
+  this->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->stop_fd < 0) {
+    std::cerr << "[ERROR] Creation of the stop eventfd failed. errno: "
+              << errno << " (" << strerror(errno) << ")\n";
+    throw "[SERVER] Failed to create the stop eventfd\n";
+  }
+
+  std::cout << "[SERVER] Server started and listening on http://" << config.ip
+            << ":" << config.port << "\n";
+  std::cout << "[SERVER] Scanning request heads with " << scanner_name()
+            << "\n";
 }
 
 Server::~Server() {
-  if (this->SERVER_SOCKET > 0) {
-    close(this->SERVER_SOCKET);
+  for (int server_socket : this->SERVER_SOCKETS) {
+    close(server_socket);
   }
+  this->SERVER_SOCKETS.clear();
+  if (this->stop_fd >= 0)
+    close(this->stop_fd);
 }
 
-void Server::bind_server(const std::string &ip, int port) {
+int Server::bind_server(const std::string &ip, int port) {
+  int server_socket =
+      socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (server_socket < 0) {
+    std::cerr << "[ERROR] Creation of server socket failed. errno: " << errno
+              << " (" << strerror(errno) << ")\n";
+    throw "[SERVER] Failed to created server socket\n";
+  }
+
+  int enable = 1;
+  setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  if (this->config.reuseport &&
+      setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &enable,
+                 sizeof(enable)) != 0) {
+    std::cerr << "[ERROR] Enabling SO_REUSEPORT failed. errno: " << errno
+              << " (" << strerror(errno) << ")\n";
+    close(server_socket);
+    throw "[SERVER] Failed to enable SO_REUSEPORT\n";
+  }
+
   sockaddr_in server_address;
   server_address.sin_family = AF_INET;
   server_address.sin_port = htons(port);
 
   if (inet_pton(AF_INET, ip.c_str(), &server_address.sin_addr) <= 0) {
-    throw std::runtime_error("Invalid IP address");
+    close(server_socket);
+    throw "[SERVER] Invalid IP address\n";
   }
 
-  int was_successful =
-      bind(this->SERVER_SOCKET, (struct sockaddr *)&server_address,
-           sizeof(server_address));
+  int was_successful = bind(server_socket, (struct sockaddr *)&server_address,
+                            sizeof(server_address));
   if (was_successful != 0) {
     std::cerr << "[ERROR] Binding the server failed. errno: " << errno << " ("
               << strerror(errno) << ")\n";
+    close(server_socket);
     throw "[SERVER] Binding the server failed\n";
   }
 
   std::cout << "[SERVER] Server bound\n";
 
   // Start listening on the socket
-  if (listen(this->SERVER_SOCKET, 10) < 0) {
+  if (listen(server_socket, this->config.backlog) < 0) {
+    close(server_socket);
     throw "[ERROR] Failed to listen on server socket";
   }
 
-  std::cout << "[SERVER] Server started and listening on http://" << ip << ":"
-            << port << "\n";
+  return server_socket;
 }
 
 void Server::run() {
-  signal(SIGINT, Server::signal_handler);
-  while (true) {
-    sockaddr_in clientAddress;
-    socklen_t clientLen = sizeof(clientAddress);
-    int client_socket = accept(this->SERVER_SOCKET,
-                               (struct sockaddr *)&clientAddress, &clientLen);
-
-    if (client_socket < 0) {
-      std::cerr << "[ERROR] Failed to accept client connection. errno: "
-                << errno << " (" << strerror(errno) << ")\n";
-      continue;
-    }
+  // Blocked before any loop thread starts, so they all inherit the mask and
+  // only the signal thread takes them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGUSR1); // Prints the stats
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  std::thread signal_thread(&Server::handle_signals, this, signals);
+
+  // The loops return once the signal thread wrote the stop eventfd, if they
+  // returned on their own the signal thread is woken up the same way
+  std::exception_ptr error;
+  try {
+    this->serve();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  if (!this->stopping)
+    pthread_kill(signal_thread.native_handle(), SIGINT);
+  signal_thread.join();
+  if (error)
+    std::rethrow_exception(error);
+}
 
-    // Recieve request here
-    char buffer[2048];
-    int was_successful = recv(client_socket, &buffer, sizeof(buffer), 0);
-    if (was_successful == -1) {
-      std::cerr << "[ERROR] Failed to receive client request. errno: " << errno
-                << " (" << strerror(errno) << ")\n";
-      if (shutdown(client_socket, SHUT_RDWR) == -1) {
-        std::cerr << "[Error] Failed to shutdown client socket. errno: "
-                  << errno << " (" << strerror(errno) << ")\n";
-      };
-      close(client_socket);
-      continue;
-    } else if (was_successful >= 2048) {
-      std::cerr << "[ERROR] The client request is bigger than 2KB\n";
-      continue;
-    }
+void Server::serve() {
+  if (this->config.io_uring && this->run_io_uring())
+    return;
 
-    // Convert request to std::string
-    buffer[was_successful] = '\0';
-    std::string client_request = buffer;
+  if (this->config.threads <= 1) {
+    EventLoop loop(*this, this->SERVER_SOCKETS[0]);
+    loop.run();
+    return;
+  }
 
-    // Create response
-    std::string res = this->evaluate_request(client_request);
+  if (this->config.reuseport) {
+    this->run_sharded();
+    return;
+  }
 
-    send(client_socket, res.c_str(), res.size(), 0);
+  // The calling thread accepts and the workers serve the connections
+  std::vector<std::unique_ptr<EventLoop>> workers;
+  for (int i = 0; i < this->config.threads; ++i) {
+    workers.push_back(std::make_unique<EventLoop>(*this, -1));
+  }
 
-    if (shutdown(client_socket, SHUT_RDWR) == -1) {
-      std::cerr << "[Error] Failed to shutdown client socket. errno: " << errno
-                << " (" << strerror(errno) << ")\n";
-    }
-    close(client_socket);
+  std::vector<std::thread> threads;
+  for (auto &worker : workers) {
+    threads.emplace_back([&worker]() { worker->run(); });
+  }
+
+  std::cout << "[SERVER] Serving with " << this->config.threads
+            << " worker threads\n";
+
+  this->dispatch_connections(workers);
+
+  for (auto &thread : threads) {
+    thread.join();
   }
-  return;
 }
 
-std::string Server::generate_response(const unsigned int &response_code,
-                                      const std::string &content,
-                                      const std::string &content_type) {
-  std::ostringstream ss;
-  ss << "HTTP/1.1 " << get_response(response_code) << "\r\n";
-  if (content.length() != 0) {
-    ss << "Content-Type: " << content_type << "\r\n";
-    ss << "Content-Length: " << content.length() << "\r\n";
-    ss << "\r\n";
-    ss << content;
+bool Server::run_io_uring() {
+  // One ring per thread, each with its own (or a shared) listener
+  std::vector<std::unique_ptr<UringLoop>> rings;
+  try {
+    for (int i = 0; i < std::max(this->config.threads, 1); ++i) {
+      int server_socket =
+          this->SERVER_SOCKETS[i % this->SERVER_SOCKETS.size()];
+      rings.push_back(std::make_unique<UringLoop>(*this, server_socket));
+    }
+  } catch (const char *e) {
+    std::cerr << e << "[SERVER] Falling back to the epoll event loop\n";
+    return false;
+  }
+
+  std::vector<std::thread> threads;
+  for (std::size_t i = 1; i < rings.size(); ++i) {
+    threads.emplace_back([&ring = rings[i]]() { ring->run(); });
   }
 
-  return ss.str();
+  std::cout << "[SERVER] Serving with " << rings.size()
+            << " io_uring event loops\n";
+
+  rings[0]->run();
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return true;
 }
 
-std::string Server::get_content_type(const std::string &path) {
-  if (ends_with(path, ".txt"))
-    return "text/plain";
-  else if (ends_with(path, ".html") || ends_with(path, ".htm"))
-    return "text/html";
-  else if (ends_with(path, ".css"))
-    return "text/css";
-  else if (ends_with(path, ".js"))
-    return "application/javascript";
-  else if (ends_with(path, ".xml"))
-    return "text/xml";
-  else if (ends_with(path, ".png"))
-    return "image/png";
-  else if (ends_with(path, ".jpg") || ends_with(path, ".jpeg"))
-    return "image/jpeg";
-  else if (ends_with(path, ".gif"))
-    return "image/gif";
-  return "application/octet-stream";
+void Server::run_sharded() {
+  // Every worker accepts on its own listener, the kernel spreads the clients
+  std::vector<std::unique_ptr<EventLoop>> shards;
+  for (int server_socket : this->SERVER_SOCKETS) {
+    shards.push_back(std::make_unique<EventLoop>(*this, server_socket));
+  }
+
+  std::vector<std::thread> threads;
+  for (std::size_t i = 1; i < shards.size(); ++i) {
+    threads.emplace_back([&shard = shards[i]]() { shard->run(); });
+  }
+
+  std::cout << "[SERVER] Serving with " << shards.size()
+            << " SO_REUSEPORT shards\n";
+
+  shards[0]->run();
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
 }
 
-std::unordered_map<std::string, std::string>
-Server::parse_headers(const std::string &req) {
-  std::unordered_map<std::string, std::string> headers;
-  std::istringstream stream(req);
-  std::string line;
-
-  // Skip the request line
-  std::getline(stream, line);
-
-  // Parse headers
-  while (std::getline(stream, line) && line != "\r") {
-    std::string::size_type pos = line.find(": ");
-    if (pos != std::string::npos) {
-      std::string key = to_lower(line.substr(0, pos));
-      std::string value = trim(line.substr(pos + 2));
-      headers[key] = value;
+void Server::dispatch_connections(
+    std::vector<std::unique_ptr<EventLoop>> &workers) {
+  std::size_t next_worker = 0;
+  int server_socket = this->SERVER_SOCKETS[0];
+  pollfd watched[2] = {{server_socket, POLLIN, 0},
+                       {this->stop_fd, POLLIN, 0}};
+
+  while (true) {
+    if (poll(watched, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "[ERROR] Waiting for clients failed. errno: " << errno
+                << " (" << strerror(errno) << ")\n";
+      return;
+    }
+    if (watched[1].revents != 0)
+      return;
+
+    // Hand out every pending client round-robin
+    while (true) {
+      int client_socket = accept4(server_socket, nullptr, nullptr,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (client_socket < 0) {
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          std::cerr << "[ERROR] Failed to accept client connection. errno: "
+                    << errno << " (" << strerror(errno) << ")\n";
+        }
+        break;
+      }
+
+      workers[next_worker]->adopt(client_socket);
+      next_worker = (next_worker + 1) % workers.size();
     }
   }
-  return headers;
 }
 
-std::pair<int, int>
-Server::get_append_position(const std::string &header_values) {
-  int line = -1; // Default value for EOF
-  int pos = -1;  // Default value for EOL
+Response Server::generate_response(std::pmr::memory_resource *memory,
+                                   const unsigned int &response_code,
+                                   std::string_view content,
+                                   std::string_view content_type) {
+  Response res = this->generate_head(memory, response_code, content.size(),
+                                     content_type);
+  res.set_body(content);
+  return res;
+}
 
-  std::size_t idx_line = header_values.find("line=");
-  std::size_t idx_pos = header_values.find("pos=");
+Response Server::fixed_response(std::pmr::memory_resource *memory,
+                                const FixedResponse &fixed) {
+  Response res(fixed.head, memory);
+  res.set_body(fixed.body);
+  return res;
+}
+
+Response Server::cached_response(std::pmr::memory_resource *memory,
+                                 std::shared_ptr<const CachedFile> file,
+                                 std::string_view content_type,
+                                 ContentCoding coding, bool vary) {
+  // The head of the entry goes out as the status line, a sibling gets the
+  // type of the file it stands in for instead
+  Response res(file->head, memory);
+  if (coding != ContentCoding::IDENTITY) {
+    res = this->generate_head(memory, 200, file->body.size(), content_type);
+    res.add_header("Last-Modified",
+                   std::string_view(file->last_modified, HTTP_DATE_LENGTH));
+  }
+  add_coding_headers(res, coding, vary);
+  // The response keeps the entry alive through its body
+  res.set_body(std::shared_ptr<const std::string>(file, &file->body));
+  return res;
+}
+
+Response Server::compressed_response(const Request &req,
+                                     std::string_view path,
+                                     std::shared_ptr<const CachedFile> file,
+                                     std::string_view content_type,
+                                     bool vary) {
+  Siblings codings = COMPRESSOR.codings(content_type, file->body.size());
+  if (!codings.any()) {
+    return this->cached_response(req.memory, std::move(file), content_type,
+                                 ContentCoding::IDENTITY, vary);
+  }
 
-  if (idx_line != std::string::npos) {
-    std::size_t end_idx = header_values.find(' ', idx_line);
-    if (end_idx == std::string::npos) {
-      end_idx = header_values.length();
+  ContentCoding coding =
+      choose_coding(req.view.header(KnownHeader::ACCEPT_ENCODING), codings);
+  std::shared_ptr<const std::string> variant;
+  if (coding != ContentCoding::IDENTITY) {
+    variant = COMPRESSOR.find(path, file->mtime, file->body.size(), coding);
+    if (!variant) {
+      // Sent as it is until a worker has compressed it
+      COMPRESSOR.compress(path, file, coding);
     }
-    line = std::stoi(header_values.substr(idx_line + 5, end_idx));
   }
-  if (idx_pos != std::string::npos) {
-    pos = std::stoi(header_values.substr(idx_pos + 4));
+  // The response depends on Accept-Encoding even when it goes out as it is
+  if (!variant) {
+    return this->cached_response(req.memory, std::move(file), content_type,
+                                 ContentCoding::IDENTITY, true);
   }
 
-  std::cout << line << ", " << pos << "\n";
-  return {line, pos};
+  Response res =
+      this->generate_head(req.memory, 200, variant->size(), content_type);
+  res.add_header("Last-Modified",
+                 std::string_view(file->last_modified, HTTP_DATE_LENGTH));
+  add_coding_headers(res, coding, true);
+  res.set_body(std::move(variant));
+  return res;
 }
 
-std::string Server::evaluate_request(const std::string &req) {
+Response Server::generate_head(std::pmr::memory_resource *memory,
+                               const unsigned int &response_code,
+                               std::size_t content_length,
+                               std::string_view content_type) {
+  Response res(get_status_line(response_code), memory);
+  if (content_length != 0) {
+    res.add_header("Content-Type", content_type);
+  }
+  // The length delimits the response on a persistent connection
+  if (response_code != 204 && response_code != 304) {
+    res.add_header("Content-Length", content_length);
+  }
+  return res;
+}
 
-  // NOTE: This is a debug print
+std::string_view Server::get_content_type(std::string_view path) const {
+  return this->mime_types.lookup(path);
+}
+
+// Parses the number behind "<key>=", which has to be the whole item
+bool parse_position(std::string_view header_values, std::string_view key,
+                    int &value) {
+  std::size_t idx = header_values.find(key);
+  if (idx == std::string_view::npos)
+    return true;
+  const char *begin = header_values.data() + idx + key.size();
+  const char *end = header_values.data() + header_values.size();
+  auto [next, error] = std::from_chars(begin, end, value);
+  return error == std::errc() &&
+         (next == end || *next == ',' || *next == ' ' || *next == ';');
+}
+
+std::optional<std::pair<int, int>>
+Server::get_append_position(std::string_view header_values) {
+  int line = -1; // Default value for EOF
+  int pos = -1;  // Default value for EOL
+
+  if (!parse_position(header_values, "line=", line) ||
+      !parse_position(header_values, "pos=", pos)) {
+    return std::nullopt;
+  }
+
+  return std::make_pair(line, pos);
+}
 
-  /*std::cout << "=============== Request ===============\n" << req << "\n";*/
+Response Server::evaluate_request(const Request &req) {
 
-  std::istringstream request_stream(req);
-  std::string request_method, path;
+  // NOTE: This is a debug print
 
-  // Read the first line from the request stream
-  if (!std::getline(request_stream, request_method, ' ') ||
-      !std::getline(request_stream, path, ' '))
-    return this->generate_response(400);
+  /*std::cout << "=============== Request ===============\n" << req.head
+   * << "\n";*/
 
-  if (path == "/")
-    path = "/index.html";
-  path = "." + path;
+  // The parser checked the request line already
+  std::string_view request_method = req.view.method;
+  // Short-lived, the arena of the connection takes it
+  std::pmr::string path(req.memory);
+  if (req.view.target == "/") {
+    path = "./index.html";
+  } else {
+    path.reserve(req.view.target.size() + 1);
+    path.append(".");
+    if (!append_normalized(path, req.view.target)) {
+      return this->generate_response(req.memory, 400);
+    }
+  }
 
-  std::string res = this->generate_response(501);
+  Response res = this->fixed_response(req.memory, NOT_IMPLEMENTED);
 
   if (request_method == "GET") {
-    res = this->get_request(path);
+    res = this->get_request(req, path);
   } else if (request_method == "POST") {
+    std::lock_guard<std::mutex> lock(FILE_WRITE_MUTEX);
     res = this->post_request(req, path);
+    FILE_CACHE.invalidate(path);
+    FILE_MAPPINGS.invalidate(path);
   } else if (request_method == "PUT") {
+    std::lock_guard<std::mutex> lock(FILE_WRITE_MUTEX);
     res = this->put_request(req, path);
+    FILE_CACHE.invalidate(path);
+    FILE_MAPPINGS.invalidate(path);
   } else if (request_method == "DELETE") {
-    res = this->delete_request(path);
+    std::lock_guard<std::mutex> lock(FILE_WRITE_MUTEX);
+    res = this->delete_request(req, path);
+    FILE_CACHE.invalidate(path);
+    FILE_MAPPINGS.invalidate(path);
   } else if (request_method == "HEAD") {
-    res = this->head_request(path);
+    res = this->head_request(req, path);
   } else {
     std::cerr << "[ERROR] This HTTP server only supports GET, POST, DELETE "
                  "and HEAD "
@@ -294,162 +529,310 @@ std::string Server::evaluate_request(const std::string &req) {
               << request_method << "\n";
   }
 
-  std::cout << "[SENDING] " << res.substr(0, res.find("\n")) << "\n";
+  // Whatever answers a HEAD request, only its head goes out
+  if (request_method == "HEAD") {
+    res.drop_body();
+  }
+
+  std::cout << "[SENDING] "
+            << res.status_line.substr(0, res.status_line.find("\r\n"))
+            << "\n";
 
   return res;
 }
 
-std::string Server::get_request(const std::string &path) {
+Response Server::get_request(const Request &req,
+                             const std::pmr::string &path) {
+
+  // A precompressed sibling the client takes is sent instead of the file.
+  // Only listed files are looked at, the others get their 403 or 404.
+  Siblings siblings;
+  if (access_allowed(path)) {
+    siblings = FILE_CACHE.siblings(path);
+  }
+  ContentCoding coding =
+      choose_coding(req.view.header(KnownHeader::ACCEPT_ENCODING), siblings);
+  if (coding == ContentCoding::IDENTITY) {
+    return this->file_response(req, path, path, coding, siblings.any());
+  }
+
+  std::pmr::string sibling(path, req.memory);
+  sibling.append(coding_suffix(coding));
+  return this->file_response(req, path, sibling, coding, true);
+}
+
+Response Server::file_response(const Request &req,
+                               const std::pmr::string &path,
+                               const std::pmr::string &file,
+                               ContentCoding coding, bool vary) {
+  std::string_view content_type = get_content_type(path);
+
+  // A cached file is served without touching the file system
+  std::shared_ptr<const CachedFile> cached = FILE_CACHE.find(file);
+  if (cached) {
+    if (!access_allowed(path)) {
+      return this->fixed_response(req.memory, FORBIDDEN);
+    }
+    if (coding == ContentCoding::IDENTITY) {
+      return this->compressed_response(req, path, std::move(cached),
+                                       content_type, vary);
+    }
+    return this->cached_response(req.memory, std::move(cached), content_type,
+                                 coding, vary);
+  }
 
-  std::ifstream file(path, std::ios::binary);
-  if (!file) {
-    return this->generate_response(
-        404, "<html><body><h1>404 Not Found</h1></body></html>");
+  // Opening a pipe must not wait for a writer
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+  if (fd < 0) {
+    return this->fixed_response(req.memory, NOT_FOUND);
   }
 
   // NOTE: Simple auth with a server-side whitelist / no user profiles
   if (!access_allowed(path)) {
-    return this->generate_response(
-        403, "The file is not contained in the server's whitelist");
+    close(fd);
+    return this->fixed_response(req.memory, FORBIDDEN);
   }
 
-  std::ostringstream ss;
-  ss << file.rdbuf();
+  struct stat result;
+  if (fstat(fd, &result) != 0) {
+    close(fd);
+    return this->generate_response(req.memory, 500);
+  }
 
-  file.close();
+  if (S_ISDIR(result.st_mode)) {
+    close(fd);
+    return this->fixed_response(req.memory, NOT_FOUND);
+  }
 
-  return this->generate_response(200, ss.str(), get_content_type(path));
-}
+  if (!S_ISREG(result.st_mode)) {
+    // Pipes and devices have no size, they are streamed until they end. The
+    // file stays non-blocking, the transport waits until it has data.
+    Response res(get_status_line(200), req.memory);
+    res.add_header("Content-Type", content_type);
+    add_coding_headers(res, coding, vary);
+    if (req.view.version == "HTTP/1.0") {
+      res.attach_file(fd, 0, FileTransfer::UNTIL_CLOSE);
+    } else {
+      res.add_header("Transfer-Encoding", "chunked");
+      res.attach_file(fd, 0, FileTransfer::CHUNKED);
+    }
+    return res;
+  }
 
-std::string Server::post_request(const std::string &req,
-                                 const std::string &path) {
+  std::size_t size = result.st_size;
+  if (FILE_CACHE.enabled()) {
+    // The entry is of the file itself, a sibling is cached with its own type
+    cached = FILE_CACHE.insert(file, fd, result, get_content_type(file));
+    if (cached) {
+      close(fd);
+      if (coding == ContentCoding::IDENTITY) {
+        return this->compressed_response(req, path, std::move(cached),
+                                         content_type, vary);
+      }
+      return this->cached_response(req.memory, std::move(cached),
+                                   content_type, coding, vary);
+    }
+  }
 
-  if (!allowed_to_post_put(path)) {
-    return this->generate_response(
-        403, "The file is not contained in the server's whitelist");
+  // Only the header passes through user space, the kernel sends the file
+  Response res =
+      this->generate_head(req.memory, 200, result.st_size, content_type);
+  char last_modified[HTTP_DATE_LENGTH];
+  format_http_date(result.st_mtime, last_modified);
+  res.add_header("Last-Modified",
+                 std::string_view(last_modified, HTTP_DATE_LENGTH));
+  add_coding_headers(res, coding, vary);
+
+  std::shared_ptr<const FileMapping> mapping;
+  if (size >= SENDFILE_MIN_SIZE && FILE_MAPPINGS.enabled()) {
+    mapping = FILE_MAPPINGS.map(file, fd, result);
   }
 
-  std::unordered_map<std::string, std::string> headers = parse_headers(req);
-  if (headers.find("content-type") != headers.end()) {
-    std::string content_type = headers["content-type"];
-    if (content_type != this->get_content_type(path)) {
-      return this->generate_response(
-          415, "The Content-Type header and the filepath do not match");
+  if (mapping) {
+    // Every client of the file is sent from the same pages
+    close(fd);
+    res.set_body(std::move(mapping));
+  } else if (size < SENDFILE_MIN_SIZE) {
+    // Small files are cheaper to send together with the header in one write
+    res.attach_file(fd, size);
+    if (!res.load_file()) {
+      return this->generate_response(req.memory, 500);
     }
+  } else if (this->config.sendfile) {
+    res.attach_file(fd, size, FileTransfer::KERNEL);
   } else {
-    return this->generate_response(400, "Missing Content-Type header");
+    res.attach_file(fd, size, FileTransfer::BLOCKS);
   }
 
-  std::string body;
+  return res;
+}
+
+bool Server::store_body(const Request &req, const std::pmr::string &path) {
+  // Never rewritten in place, the responses sending the old file from a
+  // mapping would read past its end
+  if (req.body_fd < 0) {
+    return replace_file(req.body, std::string(path));
+  }
+  // The spooled body simply takes the place of the file
+  return link_temp_file(req.body_fd, std::string(path));
+}
+
+Response Server::post_request(const Request &req,
+                              const std::pmr::string &path) {
+
+  if (!allowed_to_post_put(path)) {
+    return this->fixed_response(req.memory, FORBIDDEN);
+  }
 
-  std::string::size_type body_pos = req.find("\r\n\r\n");
-  if (body_pos != std::string::npos) {
-    body = req.substr(body_pos + 4);
+  std::optional<std::string_view> content_type =
+      req.view.header(KnownHeader::CONTENT_TYPE);
+  if (content_type) {
+    if (*content_type != this->get_content_type(path)) {
+      return this->generate_response(
+          req.memory, 415,
+          "The Content-Type header and the filepath do not match");
+    }
   } else {
-    return this->generate_response(400, "Missing Body");
+    return this->generate_response(req.memory, 400,
+                                   "Missing Content-Type header");
   }
 
   int line = -1, pos = -1;
-  std::string append_pos =
-      headers["append-position"]; // Assuming 'Append-Position:
-                                  // line=<line>,pos=<pos>' is sent in headers
-  if (!append_pos.empty()) {
-    std::pair<int, int> pos_info = get_append_position(append_pos);
-    line = pos_info.first;
-    pos = pos_info.second;
+  // Assuming 'Append-Position: line=<line>,pos=<pos>' is sent in headers
+  std::optional<std::string_view> append_pos =
+      req.view.header(KnownHeader::APPEND_POSITION);
+  if (append_pos && !append_pos->empty()) {
+    std::optional<std::pair<int, int>> pos_info =
+        get_append_position(*append_pos);
+    if (!pos_info) {
+      return this->generate_response(req.memory, 400,
+                                     "Malformed Append-Position header");
+    }
+    line = pos_info->first;
+    pos = pos_info->second;
   }
   if (std::filesystem::exists(path)) {
-    if (append_to_file(body, path, line, pos)) {
-      return this->generate_response(201, "Successfully appended to file");
+    // A spooled body is streamed into the file, never read into memory
+    bool appended =
+        req.body_fd < 0
+            ? append_to_file(req.body, std::string(path), line, pos)
+            : append_to_file(req.body_fd, std::string(path), line, pos);
+    if (appended) {
+      return this->generate_response(req.memory, 201,
+                                     "Successfully appended to file");
     } else {
-      return this->generate_response(500, "Failed to append to file");
+      return this->generate_response(req.memory, 500,
+                                     "Failed to append to file");
     }
   }
 
-  std::ofstream file(path);
-  if (!file.is_open()) {
-    return this->generate_response(500, "Could not write to file");
+  if (!this->store_body(req, path)) {
+    return this->generate_response(req.memory, 500,
+                                   "Could not write to file");
   }
-  file << body;
-  file.close();
 
-  return this->generate_response(201);
+  return this->generate_response(req.memory, 201);
 }
 
-std::string Server::put_request(const std::string &req,
-                                const std::string &path) {
-  std::string body;
-
-  std::string::size_type body_pos = req.find("\r\n\r\n");
-  if (body_pos != std::string::npos) {
-    body = req.substr(body_pos + 4);
-  } else {
-    return this->generate_response(400, "Missing Body");
+Response Server::put_request(const Request &req,
+                             const std::pmr::string &path) {
+  if (!this->store_body(req, path)) {
+    return this->generate_response(req.memory, 500,
+                                   "Could not write to file");
   }
 
-  std::ofstream file(path);
-  if (!file.is_open()) {
-    return this->generate_response(500, "Could not write to file");
-  }
-  file << body;
-  file.close();
-
-  return this->generate_response(201);
+  return this->generate_response(req.memory, 201);
 }
 
-std::string Server::delete_request(const std::string &path) {
+Response Server::delete_request(const Request &req,
+                                const std::pmr::string &path) {
 
   if (!allowed_to_delete(path)) {
-    return this->generate_response(403, "Not allowed to delete the file");
+    return this->generate_response(req.memory, 403,
+                                   "Not allowed to delete the file");
   }
 
   if (!std::filesystem::exists(path)) {
-    return this->generate_response(404, "File does not exist.");
+    return this->fixed_response(req.memory, NOT_FOUND);
   }
 
   if (!std::filesystem::remove(path)) {
-    return this->generate_response(500);
+    return this->generate_response(req.memory, 500);
   }
 
-  return this->generate_response(204);
+  return this->fixed_response(req.memory, NO_CONTENT);
 }
 
-std::string Server::head_request(const std::string &path) {
+Response Server::head_request(const Request &req,
+                              const std::pmr::string &path) {
 
-  // Check if the file exists
-  if (!std::filesystem::exists(path)) {
-    return this->generate_response(404, "File does not exist");
+  // Only the siblings of listed files are looked at
+  Siblings siblings;
+  if (access_allowed(path)) {
+    siblings = FILE_CACHE.siblings(path);
+  }
+  ContentCoding coding =
+      choose_coding(req.view.header(KnownHeader::ACCEPT_ENCODING), siblings);
+  if (coding != ContentCoding::IDENTITY) {
+    // The sibling as it was found, without another stat
+    std::size_t index = static_cast<std::size_t>(coding);
+    char last_modified[HTTP_DATE_LENGTH];
+    format_http_date(siblings.mtime[index], last_modified);
+    Response res(get_status_line(200), req.memory);
+    res.add_header("Content-Type", get_content_type(path));
+    res.add_header("Content-Length", siblings.size[index]);
+    res.add_header("Last-Modified",
+                   std::string_view(last_modified, HTTP_DATE_LENGTH));
+    add_coding_headers(res, coding, true);
+    return res;
   }
 
-  // Get the last change date of the resource
+  // Get the size and last change date of the resource, if it exists
   struct stat result;
   if (stat(path.c_str(), &result) != 0) {
-    return this->generate_response(404);
+    return this->fixed_response(req.memory, NOT_FOUND);
   }
 
-  std::time_t now = std::time(NULL);
-  std::tm now_time;
-  gmtime_r(&now, &now_time);
-
-  std::time_t mod_time = result.st_mtime;
-  std::tm gmt_time;
-  gmtime_r(&mod_time, &gmt_time);
-
-  std::string content_type = get_content_type(path);
+  char last_modified[HTTP_DATE_LENGTH];
+  format_http_date(result.st_mtime, last_modified);
 
-  auto file_size = result.st_size;
+  if (S_ISDIR(result.st_mode)) {
+    return this->fixed_response(req.memory, NOT_FOUND);
+  }
 
-  std::ostringstream ss;
-  ss << "HTTP/1.1 200 OK\r\n";
-  ss << "Content-Type: " << content_type << "\r\n";
-  ss << "Content-Length: " << file_size << "\r\n";
-  ss << "Date: " << std::put_time(&now_time, "%a, %d %b %Y %H:%M:%S GMT")
-     << "\r\n";
-  ss << "Last-Modified: "
-     << std::put_time(&gmt_time, "%a, %d %b %Y %H:%M:%S GMT") << "\r\n";
-  ss << "\r\n";
+  std::string_view content_type = get_content_type(path);
+  std::size_t size = result.st_size;
+  bool vary = siblings.any();
+  std::shared_ptr<const std::string> variant;
+  if (S_ISREG(result.st_mode) && FILE_CACHE.fits(size)) {
+    // A variant compressed for an earlier GET is what a GET gets now
+    Siblings codings = COMPRESSOR.codings(content_type, size);
+    if (codings.any()) {
+      vary = true;
+      coding = choose_coding(req.view.header(KnownHeader::ACCEPT_ENCODING),
+                             codings);
+    }
+    if (coding != ContentCoding::IDENTITY) {
+      variant = COMPRESSOR.find(path, result.st_mtim, size, coding);
+      if (!variant)
+        coding = ContentCoding::IDENTITY;
+    }
+  }
 
-  return ss.str();
+  Response res(get_status_line(200), req.memory);
+  res.add_header("Content-Type", content_type);
+  // The same framing a GET would get
+  if (variant) {
+    res.add_header("Content-Length", variant->size());
+  } else if (S_ISREG(result.st_mode)) {
+    res.add_header("Content-Length", size);
+  } else if (req.view.version != "HTTP/1.0") {
+    res.add_header("Transfer-Encoding", "chunked");
+  }
+  res.add_header("Last-Modified",
+                 std::string_view(last_modified, HTTP_DATE_LENGTH));
+  add_coding_headers(res, coding, vary);
+  return res;
 }
 
 // NOTE: End of the server class
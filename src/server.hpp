@@ -1,37 +1,167 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include "admission.hpp"
+#include "compressor.hpp"
+#include "content_coding.hpp"
+#include "file_cache.hpp"
+#include "file_mappings.hpp"
+#include "mime_types.hpp"
+#include "request.hpp"
+#include "respone_header.hpp"
+#include "response.hpp"
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <utility>
+#include <vector>
+
+class EventLoop;
+
+/*
+ * The settings the server gets started with
+ */
+struct ServerConfig {
+  std::string ip = "127.0.0.1";
+  int port = 8080;
+  int threads = 1;            // Worker threads running an event loop
+  bool reuseport = false;     // One SO_REUSEPORT listener per worker thread
+  int backlog = 10;           // Length of the pending connection queue
+  int keep_alive_timeout = 5; // Seconds an idle connection is kept open
+  int max_requests = 100;     // Requests served over one connection
+  // Limits of a single request in bytes
+  std::size_t max_header_size = 8192;
+  std::size_t max_body_size = 64 << 20; // 0 = no limit
+  // Bodies larger than this are spooled into a file instead of the memory
+  std::size_t body_spool_threshold = 64 << 10;
+  bool sendfile = true;  // Send file bodies with sendfile (zero-copy)
+  bool io_uring = false; // Use the io_uring backend if the kernel has it
+  // Past these limits clients get a 503 right away (0 = no limit)
+  unsigned int max_connections = 1000;
+  unsigned int max_queued_requests = 4096;
+  unsigned int retry_after = 1; // Seconds a shed client should wait
+  std::string mime_types_file; // A mime.types file extending the defaults
+  // Files up to the entry size are kept in memory (0 = no cache)
+  std::size_t file_cache_size = 64 << 20;
+  std::size_t file_cache_entry_size = 1 << 20;
+  // Larger files are sent from shared mappings of up to this many bytes
+  // together instead of with sendfile (0 = no mappings)
+  std::size_t mmap_budget = 0;
+  // Cached text files are compressed on the fly by these workers (0 = no
+  // compression) into variants taking up to the cache size together
+  unsigned int compression_threads = 0;
+  int compression_level = 6;
+  std::size_t compression_min_size = 1024;
+  std::size_t compression_cache_size = 16 << 20;
+};
 
 class Server {
 public:
-  Server(const std::string &ip, int port);
-  Server(Server &&) = default;
-  Server(const Server &) = default;
-  Server &operator=(Server &&) = default;
-  Server &operator=(const Server &) = default;
+  Server(const ServerConfig &config);
+  Server(Server &&) = delete;
+  Server(const Server &) = delete;
+  Server &operator=(Server &&) = delete;
+  Server &operator=(const Server &) = delete;
   ~Server();
-  static void signal_handler(int signal);
+  /*
+   * Serves until SIGINT, SIGUSR1 prints the stats meanwhile
+   */
   void run();
 
 private:
-  static int SERVER_SOCKET;
-  void bind_server(const std::string &ip, int port);
-  std::string generate_response(const unsigned int &status,
-                                const std::string &content = "",
-                                const std::string &content_type = "text/html");
-  std::string get_content_type(const std::string &path);
-  std::unordered_map<std::string, std::string>
-  parse_headers(const std::string &req);
-  std::pair<int, int> get_append_position(const std::string &body);
-  std::string evaluate_request(const std::string &req);
-  std::string get_request(const std::string &path);
-  std::string post_request(const std::string &req, const std::string &path);
-  std::string put_request(const std::string &req, const std::string &path);
-  std::string delete_request(const std::string &path);
-  std::string head_request(const std::string &path);
+  friend class EventLoop;
+  friend class ConnectionHandler;
+  friend class UringLoop;
+  static std::vector<int> SERVER_SOCKETS;
+  static AdmissionControl ADMISSION;
+  static FileMappings FILE_MAPPINGS;
+  static FileCache FILE_CACHE;
+  static Compressor COMPRESSOR;
+  ServerConfig config;
+  MimeRegistry mime_types;
+  // eventfd that becomes readable once the server shuts down, every loop
+  // watches it and returns
+  int stop_fd = -1;
+  std::atomic<bool> stopping = false;
+  int bind_server(const std::string &ip, int port);
+  /*
+   * Takes the signals blocked in all other threads with sigwait, so the
+   * stats are printed and the loops stopped from normal code
+   */
+  void handle_signals(sigset_t signals);
+  void serve();
+  void run_sharded();
+  bool run_io_uring();
+  void dispatch_connections(std::vector<std::unique_ptr<EventLoop>> &workers);
+  /*
+   * @param memory Where the buffers of the response are allocated
+   * @param content The body, only referenced, so it has to outlive the
+   * response (a literal)
+   */
+  Response generate_response(std::pmr::memory_resource *memory,
+                             const unsigned int &status,
+                             std::string_view content = "",
+                             std::string_view content_type = "text/html");
+  /*
+   * A response whose head and body are static bytes, nothing is formatted
+   */
+  Response fixed_response(std::pmr::memory_resource *memory,
+                          const FixedResponse &fixed);
+  /*
+   * The 200 response of a cached file, nothing is formatted or copied
+   * @param content_type The type of the requested file
+   * @param coding The coding of the cached file, a sibling of the requested
+   * one unless it is the identity
+   * @param vary The requested file has siblings to choose from
+   */
+  Response cached_response(std::pmr::memory_resource *memory,
+                           std::shared_ptr<const CachedFile> file,
+                           std::string_view content_type, ContentCoding coding,
+                           bool vary);
+  /*
+   * The response of a cached file in the identity coding, compressed on the
+   * fly if the client takes a coding of it and the variant is ready
+   * @param path The requested file
+   */
+  Response compressed_response(const Request &req, std::string_view path,
+                               std::shared_ptr<const CachedFile> file,
+                               std::string_view content_type, bool vary);
+  /*
+   * The response without its body, which gets attached afterwards
+   */
+  Response generate_head(std::pmr::memory_resource *memory,
+                         const unsigned int &status,
+                         std::size_t content_length,
+                         std::string_view content_type = "text/html");
+  std::string_view get_content_type(std::string_view path) const;
+  /*
+   * @return The line and position of an Append-Position header or nullopt if
+   * it is malformed
+   */
+  std::optional<std::pair<int, int>>
+  get_append_position(std::string_view header_values);
+  bool store_body(const Request &req, const std::pmr::string &path);
+  Response evaluate_request(const Request &req);
+  Response get_request(const Request &req, const std::pmr::string &path);
+  /*
+   * Sends a file as the representation of the requested path
+   * @param path The requested file, its type and whitelist entry count
+   * @param file The file to send, the path itself or a precompressed sibling
+   * @param coding The coding of the file
+   * @param vary The requested file has siblings to choose from
+   */
+  Response file_response(const Request &req, const std::pmr::string &path,
+                         const std::pmr::string &file, ContentCoding coding,
+                         bool vary);
+  Response post_request(const Request &req, const std::pmr::string &path);
+  Response put_request(const Request &req, const std::pmr::string &path);
+  Response delete_request(const Request &req, const std::pmr::string &path);
+  Response head_request(const Request &req, const std::pmr::string &path);
 };
 
 #endif
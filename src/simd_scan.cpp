@@ -0,0 +1,101 @@
+#include "simd_scan.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_SCAN_X86
+#endif
+
+// The byte a disabled colon search looks for instead, DEL is searched anyway
+const char NO_COLON = 0x7f;
+
+using ScanFunction = std::size_t (*)(const char *, std::size_t, char);
+
+bool is_delimiter(unsigned char c, char colon) {
+  return (c < 0x20 && c != '\t') || c == 0x7f || c == colon;
+}
+
+std::size_t scan_scalar(const char *data, std::size_t length, char colon) {
+  for (std::size_t i = 0; i < length; ++i) {
+    if (is_delimiter(data[i], colon))
+      return i;
+  }
+  return length;
+}
+
+#ifdef SIMD_SCAN_X86
+
+__attribute__((target("sse2"))) std::size_t
+scan_sse2(const char *data, std::size_t length, char colon) {
+  const __m128i control_limit = _mm_set1_epi8(0x1f);
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i del = _mm_set1_epi8(0x7f);
+  const __m128i colons = _mm_set1_epi8(colon);
+
+  std::size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    // Unsigned c <= 0x1f is min(c, 0x1f) == c
+    __m128i control =
+        _mm_cmpeq_epi8(_mm_min_epu8(bytes, control_limit), bytes);
+    control = _mm_andnot_si128(_mm_cmpeq_epi8(bytes, tab), control);
+    __m128i found = _mm_or_si128(
+        control, _mm_or_si128(_mm_cmpeq_epi8(bytes, del),
+                              _mm_cmpeq_epi8(bytes, colons)));
+    int mask = _mm_movemask_epi8(found);
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return i + scan_scalar(data + i, length - i, colon);
+}
+
+__attribute__((target("avx2"))) std::size_t
+scan_avx2(const char *data, std::size_t length, char colon) {
+  const __m256i control_limit = _mm256_set1_epi8(0x1f);
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i del = _mm256_set1_epi8(0x7f);
+  const __m256i colons = _mm256_set1_epi8(colon);
+
+  std::size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    __m256i control =
+        _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, control_limit), bytes);
+    control = _mm256_andnot_si256(_mm256_cmpeq_epi8(bytes, tab), control);
+    __m256i found = _mm256_or_si256(
+        control, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, del),
+                                 _mm256_cmpeq_epi8(bytes, colons)));
+    unsigned int mask = _mm256_movemask_epi8(found);
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  // The rest is shorter than a vector
+  return i + scan_sse2(data + i, length - i, colon);
+}
+
+#endif
+
+struct Scanner {
+  ScanFunction scan;
+  const char *name;
+};
+
+Scanner select_scanner() {
+#ifdef SIMD_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return {scan_avx2, "AVX2"};
+  if (__builtin_cpu_supports("sse2"))
+    return {scan_sse2, "SSE2"};
+#endif
+  return {scan_scalar, "scalar"};
+}
+
+const Scanner SCANNER = select_scanner();
+
+std::size_t scan_delimiter(const char *data, std::size_t length, bool colons) {
+  return SCANNER.scan(data, length, colons ? ':' : NO_COLON);
+}
+
+const char *scanner_name() { return SCANNER.name; }
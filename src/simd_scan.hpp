@@ -0,0 +1,23 @@
+#ifndef SIMD_SCAN_H
+#define SIMD_SCAN_H
+
+#include <cstddef>
+
+/*
+ * Finds the next byte the request parser has to look at: a control character
+ * (CR, LF and everything else below 0x20 except tab, or DEL) or, if colons is
+ * set, a colon. The bytes are tested 32 (AVX2) or 16 (SSE2) at a time, the
+ * implementation is chosen for the CPU at startup.
+ * @param data The bytes to scan
+ * @param length The number of bytes
+ * @param colons Stop at colons as well
+ * @return The index of the byte found or length if there is none
+ */
+std::size_t scan_delimiter(const char *data, std::size_t length, bool colons);
+
+/*
+ * @return The name of the implementation scan_delimiter uses
+ */
+const char *scanner_name();
+
+#endif // !SIMD_SCAN_H
@@ -0,0 +1,13 @@
+#include "string_utils.hpp"
+#include <cctype>
+
+bool iequals(std::string_view a, std::string_view b) {
+  if (a.size() != b.size())
+    return false;
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    unsigned char x = a[i], y = b[i];
+    if (x != y && std::tolower(x) != std::tolower(y))
+      return false;
+  }
+  return true;
+}
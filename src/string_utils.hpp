@@ -0,0 +1,11 @@
+#ifndef STRING_UTILS_H
+#define STRING_UTILS_H
+
+#include <string_view>
+
+/*
+ * Compares two strings ignoring the case of ASCII letters
+ */
+bool iequals(std::string_view a, std::string_view b);
+
+#endif // !STRING_UTILS_H
@@ -0,0 +1,120 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "recycler.hpp"
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/*
+ * What every Task promise has: the coroutine to continue with once the task
+ * finished and the exception it may have finished with
+ */
+struct TaskPromiseBase {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+
+  /*
+   * Hands control straight to the awaiting coroutine (or back to whoever
+   * resumed the task if nothing awaits it), so chains of awaited tasks don't
+   * grow the stack
+   */
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      std::coroutine_handle<> continuation = handle.promise().continuation;
+      if (continuation)
+        return continuation;
+      return std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  // A connection awaits the same coroutines for every request, their frames
+  // are recycled
+  static void *operator new(std::size_t size) {
+    return recycled_allocate(size);
+  }
+  static void operator delete(void *frame, std::size_t size) {
+    recycled_deallocate(frame, size);
+  }
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  // Rethrown where the task is awaited, a task nothing awaits has to catch
+  // its exceptions itself
+  void unhandled_exception() { this->exception = std::current_exception(); }
+};
+
+template <typename T> struct TaskPromise : TaskPromiseBase {
+  std::optional<T> value;
+
+  void return_value(T result) { this->value = std::move(result); }
+  T result() {
+    if (this->exception)
+      std::rethrow_exception(this->exception);
+    return std::move(*this->value);
+  }
+};
+
+template <> struct TaskPromise<void> : TaskPromiseBase {
+  void return_void() {}
+  void result() {
+    if (this->exception)
+      std::rethrow_exception(this->exception);
+  }
+};
+
+/*
+ * A coroutine that only starts running when it gets awaited (or started), so
+ * it can be awaited like a function call that may suspend. The task owns its
+ * coroutine frame and destroys it with itself.
+ */
+template <typename T = void> class Task {
+public:
+  struct promise_type : TaskPromise<T> {
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+
+  Task() = default;
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+  Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (this->handle)
+        this->handle.destroy();
+      this->handle = std::exchange(other.handle, {});
+    }
+    return *this;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() {
+    if (this->handle)
+      this->handle.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    this->handle.promise().continuation = awaiting;
+    return this->handle;
+  }
+  T await_resume() { return this->handle.promise().result(); }
+
+  /*
+   * Runs a task nothing awaits until it suspends for the first time
+   */
+  void start() { this->handle.resume(); }
+  bool done() const { return !this->handle || this->handle.done(); }
+
+private:
+  std::coroutine_handle<promise_type> handle;
+};
+
+#endif // !TASK_H
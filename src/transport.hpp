@@ -0,0 +1,52 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "connection.hpp"
+#include "response.hpp"
+#include "task.hpp"
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * The awaitable socket operations an event loop backend offers the
+ * connection coroutines. A coroutine awaiting one of them is suspended until
+ * the loop sees the operation finish, the thread serves the other
+ * connections meanwhile.
+ */
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  /*
+   * Receives the next bytes of the client and appends them to its buffer
+   * @return The number of received bytes, 0 if the client shut down its
+   * sending side or -errno
+   */
+  virtual Task<ssize_t> receive(Connection &conn) = 0;
+
+  /*
+   * Sends the gathered buffers with as few system calls as possible
+   * @return The number of sent bytes (maybe less than all) or -errno
+   */
+  virtual Task<ssize_t> send(Connection &conn, const iovec *iov,
+                             std::size_t count) = 0;
+
+  /*
+   * Sends the remaining file body of a response with a known length. A
+   * backend that can't send the file directly may switch the response to
+   * FileTransfer::BLOCKS instead, the connection handler streams it then.
+   * @return 0 or -errno
+   */
+  virtual Task<int> send_file(Connection &conn, Response &response) = 0;
+
+  /*
+   * Reads the next bytes of a non-blocking file without a length (a pipe or
+   * a device), waiting until it has some
+   * @return The number of read bytes, 0 at the end of the file or -errno
+   */
+  virtual Task<ssize_t> read_file(Connection &conn, int fd, char *buffer,
+                                  std::size_t length) = 0;
+};
+
+#endif // !TRANSPORT_H
@@ -0,0 +1,434 @@
+#include "uring_loop.hpp"
+#include "http_date.hpp"
+#include "server.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+const unsigned int RING_ENTRIES = 1024;
+// The receive buffers the kernel picks from
+const unsigned int RECV_BUFFER_COUNT = 256;
+const unsigned int RECV_BUFFER_SIZE = 16 << 10;
+// File bodies are read and sent in chunks of this size
+const std::size_t FILE_CHUNK_SIZE = 64 << 10;
+const long long IDLE_CHECK_INTERVAL_S = 1;
+
+// The user_data of the operations no coroutine awaits, everything else
+// points to a Completion
+const uint64_t BUFFERS_USER_DATA = 0; // Handing receive buffers back
+const uint64_t ACCEPT_USER_DATA = 1;
+const uint64_t TIMEOUT_USER_DATA = 2;
+const uint64_t STOP_USER_DATA = 3;
+const uint64_t PROBE_USER_DATA = 4;
+const uint64_t CANCEL_USER_DATA = 6; // After the two of the probe
+
+UringLoop::UringLoop(Server &server, int listen_socket)
+    : server(server), handler(server), ring(RING_ENTRIES),
+      listen_socket(listen_socket) {
+  this->multishot_accept = this->probe_multishot_accept();
+  if (!this->multishot_accept) {
+    std::cout << "[SERVER] The kernel lacks multishot accept, every accept "
+                 "is armed again\n";
+  }
+  this->ring.provide_buffers(RECV_BUFFER_COUNT, RECV_BUFFER_SIZE);
+  this->idle_check_interval.tv_sec = IDLE_CHECK_INTERVAL_S;
+  this->idle_check_interval.tv_nsec = 0;
+}
+
+UringLoop::~UringLoop() {
+  // The operations in flight point into the sessions and their coroutine
+  // frames, they have to be done before those are freed
+  this->cancel_operations();
+  for (auto &entry : this->sessions) {
+    this->handler.release(entry.second->conn);
+    close(entry.second->conn.socket);
+  }
+}
+
+void UringLoop::run() {
+  this->arm_accept();
+  this->arm_timeout();
+  this->arm_stop();
+
+  while (!this->stopped) {
+    // Submit everything prepared in the last round and wait in one go
+    int result = this->ring.submit_and_wait(1);
+    if (result < 0 && result != -EINTR && result != -EAGAIN &&
+        result != -EBUSY) {
+      std::cerr << "[ERROR] Waiting for io_uring completions failed. errno: "
+                << -result << " (" << strerror(-result) << ")\n";
+      return;
+    }
+    refresh_http_date();
+
+    io_uring_cqe *cqe;
+    while ((cqe = this->ring.peek_cqe()) != nullptr) {
+      io_uring_cqe completion = *cqe;
+      this->ring.cqe_seen();
+      this->handle_completion(completion);
+    }
+    this->close_finished();
+  }
+}
+
+void UringLoop::cancel_operations() {
+  // The receives and sends of shut down sockets complete right away, file
+  // reads complete on their own
+  for (auto &entry : this->sessions) {
+    shutdown(entry.second->conn.socket, SHUT_RDWR);
+  }
+  for (uint64_t user_data :
+       {ACCEPT_USER_DATA, TIMEOUT_USER_DATA, STOP_USER_DATA}) {
+    io_uring_sqe *sqe = this->ring.get_sqe();
+    if (sqe == nullptr) {
+      std::cerr << "[ERROR] The io_uring submission ring is full\n";
+      break;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = user_data;
+    sqe->user_data = CANCEL_USER_DATA;
+  }
+  this->ring.wait_idle();
+}
+
+bool UringLoop::probe_multishot_accept() {
+  // Nobody connects, the accept either stays armed or fails right away
+  int probe_socket =
+      socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  io_uring_sqe *sqes[2];
+  if (probe_socket < 0 ||
+      bind(probe_socket, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      listen(probe_socket, 1) < 0 || !this->ring.get_sqes(sqes, 2)) {
+    if (probe_socket >= 0)
+      close(probe_socket);
+    return false;
+  }
+
+  sqes[0]->opcode = IORING_OP_ACCEPT;
+  sqes[0]->fd = probe_socket;
+  sqes[0]->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqes[0]->user_data = PROBE_USER_DATA;
+  sqes[1]->opcode = IORING_OP_ASYNC_CANCEL;
+  sqes[1]->addr = PROBE_USER_DATA;
+  sqes[1]->user_data = PROBE_USER_DATA + 1;
+
+  // Kernels that don't know the flag reject the accept with EINVAL, the
+  // others complete it with ECANCELED once the cancellation got it
+  int accept_result = -EINVAL;
+  unsigned int completed = 0;
+  while (completed < 2) {
+    int result = this->ring.submit_and_wait(1);
+    if (result < 0 && result != -EINTR && result != -EAGAIN &&
+        result != -EBUSY) {
+      break;
+    }
+    io_uring_cqe *cqe;
+    while ((cqe = this->ring.peek_cqe()) != nullptr) {
+      if (cqe->user_data == PROBE_USER_DATA &&
+          !(cqe->flags & IORING_CQE_F_MORE)) {
+        accept_result = cqe->res;
+        ++completed;
+      } else if (cqe->user_data == PROBE_USER_DATA + 1) {
+        ++completed;
+      }
+      this->ring.cqe_seen();
+    }
+  }
+  close(probe_socket);
+  return completed == 2 && accept_result != -EINVAL;
+}
+
+void UringLoop::arm_accept() {
+  io_uring_sqe *sqe = this->ring.get_sqe();
+  if (sqe == nullptr) {
+    std::cerr << "[ERROR] The io_uring submission ring is full\n";
+    return;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = this->listen_socket;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  if (this->multishot_accept)
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = ACCEPT_USER_DATA;
+}
+
+void UringLoop::arm_timeout() {
+  io_uring_sqe *sqe = this->ring.get_sqe();
+  if (sqe == nullptr) {
+    std::cerr << "[ERROR] The io_uring submission ring is full\n";
+    return;
+  }
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uint64_t>(&this->idle_check_interval);
+  sqe->len = 1;
+  sqe->user_data = TIMEOUT_USER_DATA;
+}
+
+void UringLoop::arm_stop() {
+  io_uring_sqe *sqe = this->ring.get_sqe();
+  if (sqe == nullptr) {
+    std::cerr << "[ERROR] The io_uring submission ring is full\n";
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = this->server.stop_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = STOP_USER_DATA;
+}
+
+void UringLoop::handle_completion(const io_uring_cqe &cqe) {
+  if (cqe.user_data == BUFFERS_USER_DATA) {
+    if (cqe.res < 0) {
+      std::cerr << "[ERROR] Providing io_uring receive buffers failed. errno: "
+                << -cqe.res << " (" << strerror(-cqe.res) << ")\n";
+    }
+    return;
+  }
+  if (cqe.user_data == ACCEPT_USER_DATA) {
+    this->handle_accept(cqe);
+    return;
+  }
+  if (cqe.user_data == TIMEOUT_USER_DATA) {
+    this->close_idle_connections();
+    this->arm_timeout();
+    return;
+  }
+  if (cqe.user_data == STOP_USER_DATA) {
+    if (cqe.res < 0) {
+      std::cerr << "[ERROR] Watching the stop eventfd failed. errno: "
+                << -cqe.res << " (" << strerror(-cqe.res) << ")\n";
+      return;
+    }
+    // The open connections are closed with the loop
+    this->stopped = true;
+    return;
+  }
+
+  Completion *completion = reinterpret_cast<Completion *>(cqe.user_data & ~1);
+  unsigned int index = cqe.user_data & 1;
+  completion->result[index] = cqe.res;
+  if (index == 0)
+    completion->flags = cqe.flags;
+  if (--completion->pending == 0 && completion->waiter) {
+    completion->waiter.resume();
+  }
+}
+
+void UringLoop::handle_accept(const io_uring_cqe &cqe) {
+  // A multishot accept stays armed as long as the kernel says there is more,
+  // a single-shot one is done with every completion
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    this->arm_accept();
+  }
+
+  if (cqe.res < 0) {
+    if (cqe.res != -EAGAIN && cqe.res != -ECONNABORTED && cqe.res != -EINTR) {
+      std::cerr << "[ERROR] Failed to accept client connection. errno: "
+                << -cqe.res << " (" << strerror(-cqe.res) << ")\n";
+    }
+    return;
+  }
+  if (!this->handler.admit(cqe.res))
+    return;
+
+  auto session = std::make_unique<Session>();
+  session->id = this->next_id++;
+  if (this->next_id == 0)
+    this->next_id = 1;
+  session->conn.socket = cqe.res;
+  session->conn.last_activity = std::chrono::steady_clock::now();
+
+  Session &added = *session;
+  this->sessions[added.id] = std::move(session);
+  added.task = this->serve(added);
+  added.task.start();
+}
+
+Task<> UringLoop::serve(Session &session) {
+  // Nothing awaits the task, an exception would end it unnoticed and leave
+  // the connection open forever
+  try {
+    co_await this->handler.serve(*this, session.conn);
+  } catch (const std::exception &error) {
+    std::cerr << "[ERROR] Serving the client failed: " << error.what()
+              << "\n";
+  } catch (...) {
+    std::cerr << "[ERROR] Serving the client failed\n";
+  }
+  this->finished.push_back(session.id);
+}
+
+Task<ssize_t> UringLoop::receive(Connection &conn) {
+  while (true) {
+    io_uring_sqe *sqe = this->ring.get_sqe();
+    if (sqe == nullptr)
+      co_return -EBUSY;
+    Completion completion(1);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.socket;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = completion.user_data(0);
+    int result = co_await completion;
+
+    if (completion.flags & IORING_CQE_F_BUFFER) {
+      unsigned short buffer_id = completion.flags >> IORING_CQE_BUFFER_SHIFT;
+      if (result > 0)
+        conn.buffer.append(this->ring.buffer(buffer_id), result);
+      this->ring.recycle_buffer(buffer_id);
+    }
+    // Out of buffers until the recycled ones are submitted again
+    if (result == -ENOBUFS || result == -EINTR)
+      continue;
+    co_return result;
+  }
+}
+
+Task<ssize_t> UringLoop::send(Connection &conn, const iovec *iov,
+                              std::size_t count) {
+  io_uring_sqe *sqe = this->ring.get_sqe();
+  if (sqe == nullptr)
+    co_return -EBUSY;
+
+  msghdr message{};
+  message.msg_iov = const_cast<iovec *>(iov);
+  message.msg_iovlen = count;
+  Completion completion(1);
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = conn.socket;
+  sqe->addr = reinterpret_cast<uint64_t>(&message);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  sqe->user_data = completion.user_data(0);
+  co_return co_await completion;
+}
+
+Task<int> UringLoop::send_file(Connection &conn, Response &response) {
+  std::unique_ptr<char[]> chunk(new char[FILE_CHUNK_SIZE]);
+
+  while (response.file_length > 0) {
+    // Read the chunk and send it as soon as the read completed
+    std::size_t length = std::min(response.file_length, FILE_CHUNK_SIZE);
+    // Both entries at once, nothing may be submitted between the linked pair
+    io_uring_sqe *sqes[2];
+    if (!this->ring.get_sqes(sqes, 2))
+      co_return -EBUSY;
+    io_uring_sqe *read_sqe = sqes[0];
+    io_uring_sqe *send_sqe = sqes[1];
+
+    Completion completion(2);
+    read_sqe->opcode = IORING_OP_READ;
+    read_sqe->fd = response.file_fd;
+    read_sqe->addr = reinterpret_cast<uint64_t>(chunk.get());
+    read_sqe->len = length;
+    read_sqe->off = response.file_offset;
+    read_sqe->flags = IOSQE_IO_LINK;
+    read_sqe->user_data = completion.user_data(0);
+    send_sqe->opcode = IORING_OP_SEND;
+    send_sqe->fd = conn.socket;
+    send_sqe->addr = reinterpret_cast<uint64_t>(chunk.get());
+    send_sqe->len = length;
+    send_sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    send_sqe->user_data = completion.user_data(1);
+    co_await completion;
+
+    // A failed or short read cancels the linked send, the file shrank or
+    // broke and the promised length can't be kept
+    if (completion.result[0] < 0)
+      co_return completion.result[0];
+    if (static_cast<std::size_t>(completion.result[0]) != length)
+      co_return -EIO;
+    if (completion.result[1] < 0)
+      co_return completion.result[1];
+
+    std::size_t sent = completion.result[1];
+    while (sent < length) {
+      iovec rest;
+      rest.iov_base = chunk.get() + sent;
+      rest.iov_len = length - sent;
+      ssize_t result = co_await this->send(conn, &rest, 1);
+      if (result < 0)
+        co_return result;
+      sent += result;
+    }
+    response.file_offset += length;
+    response.file_length -= length;
+  }
+  co_return 0;
+}
+
+Task<ssize_t> UringLoop::read_file(Connection &, int fd, char *buffer,
+                                   std::size_t length) {
+  while (true) {
+    io_uring_sqe *sqe = this->ring.get_sqe();
+    if (sqe == nullptr)
+      co_return -EBUSY;
+    Completion read_completion(1);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = length;
+    sqe->off = static_cast<uint64_t>(-1); // The file position, pipes have none
+    sqe->user_data = read_completion.user_data(0);
+    int result = co_await read_completion;
+    if (result == -EINTR)
+      continue;
+    if (result != -EAGAIN)
+      co_return result;
+
+    // The file is non-blocking, the read is tried again once it has data
+    sqe = this->ring.get_sqe();
+    if (sqe == nullptr)
+      co_return -EBUSY;
+    Completion poll_completion(1);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = poll_completion.user_data(0);
+    result = co_await poll_completion;
+    if (result < 0)
+      co_return result;
+  }
+}
+
+void UringLoop::close_finished() {
+  for (uint32_t id : this->finished) {
+    auto it = this->sessions.find(id);
+    if (it == this->sessions.end())
+      continue;
+    Connection &conn = it->second->conn;
+    this->handler.release(conn);
+    if (shutdown(conn.socket, SHUT_RDWR) == -1 && errno != ENOTCONN) {
+      std::cerr << "[Error] Failed to shutdown client socket. errno: " << errno
+                << " (" << strerror(errno) << ")\n";
+    }
+    close(conn.socket);
+    this->sessions.erase(it);
+  }
+  this->finished.clear();
+}
+
+void UringLoop::close_idle_connections() {
+  auto now = std::chrono::steady_clock::now();
+  auto timeout = std::chrono::seconds(this->server.config.keep_alive_timeout);
+  this->handler.close_shed_clients();
+
+  for (auto &entry : this->sessions) {
+    const Connection &conn = entry.second->conn;
+    if (conn.state == ConnectionState::READING &&
+        now - conn.last_activity >= timeout) {
+      shutdown(conn.socket, SHUT_RDWR);
+    }
+  }
+}
@@ -0,0 +1,119 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include "connection.hpp"
+#include "connection_handler.hpp"
+#include "io_uring.hpp"
+#include "task.hpp"
+#include "transport.hpp"
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class Server;
+
+/*
+ * A completion-based event loop on io_uring. Clients come from a multishot
+ * accept (re-armed after every client on kernels before 5.19, which lack
+ * it), receives pick their buffer from a group of provided buffers and file
+ * bodies are sent with linked read-then-send chains. Everything prepared in
+ * one round is submitted with a single system call. The coroutine serving a
+ * client is resumed by the completion of the operation it awaits.
+ */
+class UringLoop : public Transport {
+public:
+  /*
+   * Throws if io_uring (or one of the features used) isn't available
+   * @param server The server whose evaluate_request answers the requests
+   * @param listen_socket The socket to accept clients from
+   */
+  UringLoop(Server &server, int listen_socket);
+  UringLoop(const UringLoop &) = delete;
+  UringLoop &operator=(const UringLoop &) = delete;
+  ~UringLoop();
+  void run();
+
+  Task<ssize_t> receive(Connection &conn) override;
+  Task<ssize_t> send(Connection &conn, const iovec *iov,
+                     std::size_t count) override;
+  Task<int> send_file(Connection &conn, Response &response) override;
+  Task<ssize_t> read_file(Connection &conn, int fd, char *buffer,
+                          std::size_t length) override;
+
+private:
+  /*
+   * A client and the coroutine serving it
+   */
+  struct Session {
+    Connection conn;
+    uint32_t id = 0;
+    Task<> task;
+  };
+
+  /*
+   * Awaits the completions of one or two (linked) submitted operations. The
+   * user_data of each points here, with the index of the operation in the
+   * low bit.
+   */
+  struct Completion {
+    int result[2] = {0, 0};
+    uint32_t flags = 0; // The flags of the first operation
+    unsigned int pending;
+    std::coroutine_handle<> waiter;
+
+    explicit Completion(unsigned int operations) : pending(operations) {}
+    uint64_t user_data(unsigned int index) {
+      return reinterpret_cast<uint64_t>(this) | index;
+    }
+    bool await_ready() const noexcept { return this->pending == 0; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+      this->waiter = handle;
+    }
+    int await_resume() const noexcept { return this->result[0]; }
+  };
+
+  Server &server;
+  ConnectionHandler handler;
+  IoUring ring;
+  int listen_socket;
+  uint32_t next_id = 1;
+  std::unordered_map<uint32_t, std::unique_ptr<Session>> sessions;
+  std::vector<uint32_t> finished; // Sessions whose coroutine returned
+  __kernel_timespec idle_check_interval;
+  bool multishot_accept = false;
+  bool stopped = false; // The server shuts down
+
+  /*
+   * Arms a multishot accept on a throwaway listener and cancels it again,
+   * the opcode probe doesn't tell if the kernel supports the flag
+   */
+  bool probe_multishot_accept();
+  void arm_accept();
+  void arm_timeout();
+  /*
+   * Polls the stop eventfd of the server, the loop returns once it fires
+   */
+  void arm_stop();
+  /*
+   * Cancels the accept, the timeout and the stop poll, shuts the clients
+   * down and waits until no operation is in flight anymore
+   */
+  void cancel_operations();
+  void handle_completion(const io_uring_cqe &cqe);
+  void handle_accept(const io_uring_cqe &cqe);
+  /*
+   * The top-level coroutine of a client, marks the session as finished once
+   * the connection ends
+   */
+  Task<> serve(Session &session);
+  void close_finished();
+  /*
+   * Shuts idle connections down, the receive their coroutine awaits fails and
+   * the coroutine returns
+   */
+  void close_idle_connections();
+};
+
+#endif // !URING_LOOP_H
@@ -0,0 +1,157 @@
+#include "server.hpp"
+#include "test.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <netinet/in.h>
+#include <new>
+#include <streambuf>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// Requests answered before counting, the buffers and caches are warm then
+const int WARMUP_REQUESTS = 200;
+const int COUNTED_REQUESTS = 2000;
+
+// Every allocation of the process while counting is on
+std::atomic<bool> counting = false;
+std::atomic<unsigned long> allocations = 0;
+
+void *allocate(std::size_t size) {
+  if (counting.load(std::memory_order_relaxed))
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  void *memory = std::malloc(size == 0 ? 1 : size);
+  if (memory == nullptr)
+    throw std::bad_alloc();
+  return memory;
+}
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return operator new(size, std::nothrow);
+}
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t) noexcept {
+  std::free(memory);
+}
+void operator delete[](void *memory, std::size_t) noexcept {
+  std::free(memory);
+}
+
+// Swallows the log of every request, writing it out would dominate the test
+class NullBuffer : public std::streambuf {
+protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char *, std::streamsize count) override {
+    return count;
+  }
+};
+
+// Sends a request and reads its response, which ends with the body
+bool request(int client, std::string_view request, std::string_view body) {
+  if (send(client, request.data(), request.size(), 0) !=
+      static_cast<ssize_t>(request.size())) {
+    return false;
+  }
+  char buffer[4096];
+  std::size_t received = 0;
+  while (received < sizeof(buffer)) {
+    ssize_t result = recv(client, buffer + received,
+                          sizeof(buffer) - received, 0);
+    if (result <= 0)
+      return false;
+    received += result;
+    std::string_view response(buffer, received);
+    if (response.ends_with(body) && response.starts_with("HTTP/1.1 200"))
+      return true;
+  }
+  return false;
+}
+
+void run(bool io_uring) {
+  ServerConfig config;
+  config.port = 20000 + getpid() % 20000 + (io_uring ? 1 : 0);
+  config.io_uring = io_uring;
+  config.max_requests = WARMUP_REQUESTS + COUNTED_REQUESTS + 1;
+
+  Server server(config);
+  std::thread serving([&server]() { server.run(); });
+
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(config.port);
+  inet_pton(AF_INET, config.ip.c_str(), &address.sin_addr);
+  bool connected = false;
+  for (int attempt = 0; attempt < 100 && !connected; ++attempt) {
+    connected = connect(client, reinterpret_cast<sockaddr *>(&address),
+                        sizeof(address)) == 0;
+    if (!connected)
+      usleep(10000);
+  }
+  check(connected, "connected");
+
+  std::string_view get = "GET /index.html HTTP/1.1\r\nHost: x\r\n"
+                         "User-Agent: test\r\nAccept: */*\r\n\r\n";
+  bool answered = connected;
+  for (int i = 0; i < WARMUP_REQUESTS && answered; ++i)
+    answered = request(client, get, "allocation test\n");
+  counting = true;
+  for (int i = 0; i < COUNTED_REQUESTS && answered; ++i)
+    answered = request(client, get, "allocation test\n");
+  counting = false;
+  check(answered, "keep-alive GETs answered");
+  std::cerr << "[INFO] " << allocations << " allocations in "
+            << COUNTED_REQUESTS << " requests"
+            << (io_uring ? " (io_uring)" : "") << "\n";
+  check(allocations == 0, "steady-state GETs allocate nothing");
+  allocations = 0;
+
+  close(client);
+  // Taken by the signal thread of the server like a Ctrl+C
+  kill(getpid(), SIGINT);
+  serving.join();
+}
+
+int main() {
+  // The server serves the files of its working directory
+  char directory[] = "/tmp/allocation-test-XXXXXX";
+  if (mkdtemp(directory) == nullptr || chdir(directory) != 0) {
+    std::cerr << "[FAIL] Can't create the test directory\n";
+    return 1;
+  }
+  std::ofstream("index.html") << "allocation test\n";
+  std::ofstream("server_lists.serverconf")
+      << "[whitelist]\n./index.html\n\n[deletelist]\n\n[post_put_list]\n";
+
+  // Blocked before the server starts, so only its signal thread takes it
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  NullBuffer null_buffer;
+  std::streambuf *log = std::cout.rdbuf(&null_buffer);
+  run(false);
+  run(true);
+  std::cout.rdbuf(log);
+
+  unlink("index.html");
+  unlink("server_lists.serverconf");
+  rmdir(directory);
+  return report("allocation");
+}
@@ -0,0 +1,74 @@
+#include "chunked_decoder.hpp"
+#include "test.hpp"
+#include <string>
+#include <string_view>
+
+// Decodes a whole body, split into pieces of the given size
+ParseStatus decode(std::string_view body, std::size_t piece,
+                   std::string &data) {
+  ChunkedDecoder decoder;
+  data.clear();
+  std::string pending;
+  for (std::size_t i = 0; i < body.size(); i += piece) {
+    pending.append(body.substr(i, piece));
+    while (!pending.empty()) {
+      std::size_t consumed;
+      std::string_view decoded;
+      ParseStatus status = decoder.decode(pending, consumed, decoded);
+      data.append(decoded);
+      pending.erase(0, consumed);
+      if (status != ParseStatus::INCOMPLETE)
+        return status;
+      if (consumed == 0)
+        break;
+    }
+  }
+  return ParseStatus::INCOMPLETE;
+}
+
+bool decodes(std::string_view body, std::string_view expected) {
+  // Every way of splitting the body has to give the same data
+  for (std::size_t piece : {body.size(), std::size_t(1), std::size_t(3)}) {
+    std::string data;
+    if (decode(body, piece, data) != ParseStatus::COMPLETE ||
+        data != expected) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool fails(std::string_view body) {
+  for (std::size_t piece : {body.size(), std::size_t(1)}) {
+    std::string data;
+    if (decode(body, piece, data) != ParseStatus::FAILED)
+      return false;
+  }
+  return true;
+}
+
+int main() {
+  check(decodes("5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", "hello world"),
+        "two chunks");
+  check(decodes("A\r\n0123456789\r\n0\r\n\r\n", "0123456789"),
+        "upper case hex");
+  check(decodes("3;name=value\r\nabc\r\n0\r\n\r\n", "abc"), "extension");
+  check(decodes("3 \t;ext\r\nabc\r\n0\r\n\r\n", "abc"),
+        "whitespace before the extension");
+  check(decodes("3  \r\nabc\r\n0\r\n\r\n", "abc"),
+        "whitespace before the line end");
+  check(decodes("3\nabc\n0\n\n", "abc"), "bare LF line ends");
+  check(decodes("3\r\nabc\r\n0\r\nX-Trailer: yes\r\n\r\n", "abc"),
+        "trailer section");
+
+  check(fails("\r\nabc\r\n0\r\n\r\n"), "no size");
+  check(fails("zz\r\nabc\r\n0\r\n\r\n"), "size not hex");
+  check(fails("3x\r\nabc\r\n0\r\n\r\n"), "junk behind the size");
+  check(fails("3 x\r\nabc\r\n0\r\n\r\n"), "junk behind whitespace");
+  check(fails("0x3\r\nabc\r\n0\r\n\r\n"), "hex prefix");
+  check(fails("3\r \r\nabc\r\n0\r\n\r\n"), "whitespace behind the CR");
+  check(fails("3\rabc\r\n0\r\n\r\n"), "CR without LF");
+  check(fails("3\r\nabcX\r\n0\r\n\r\n"), "data longer than its size");
+  check(fails("10000000000000000\r\n"), "size overflow");
+  return report("chunked_decoder");
+}
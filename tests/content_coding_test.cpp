@@ -0,0 +1,51 @@
+#include "content_coding.hpp"
+#include "test.hpp"
+#include <optional>
+#include <string_view>
+
+Siblings siblings(std::size_t gzip_size, std::size_t brotli_size) {
+  Siblings found;
+  std::size_t gzip = static_cast<std::size_t>(ContentCoding::GZIP);
+  std::size_t brotli = static_cast<std::size_t>(ContentCoding::BROTLI);
+  found.exists[gzip] = gzip_size > 0;
+  found.size[gzip] = gzip_size;
+  found.exists[brotli] = brotli_size > 0;
+  found.size[brotli] = brotli_size;
+  return found;
+}
+
+int main() {
+  Siblings both = siblings(100, 80);
+  Siblings gzip_only = siblings(100, 0);
+  Siblings none = siblings(0, 0);
+
+  check(choose_coding(std::nullopt, both) == ContentCoding::IDENTITY,
+        "no Accept-Encoding");
+  check(choose_coding("gzip, br", none) == ContentCoding::IDENTITY,
+        "no siblings");
+  check(choose_coding("gzip, br", both) == ContentCoding::BROTLI,
+        "ties go to the smaller sibling");
+  check(choose_coding("gzip;q=1, br;q=0.5", both) == ContentCoding::GZIP,
+        "higher quality wins");
+  check(choose_coding("br;q=0", gzip_only) == ContentCoding::IDENTITY,
+        "sibling the client doesn't take");
+  check(choose_coding("x-gzip", gzip_only) == ContentCoding::GZIP,
+        "x-gzip");
+  check(choose_coding("GZIP ; Q=0.8", gzip_only) == ContentCoding::GZIP,
+        "case and whitespace");
+  check(choose_coding("*", both) == ContentCoding::BROTLI, "wildcard");
+  check(choose_coding("*;q=0, gzip", both) == ContentCoding::GZIP,
+        "wildcard excludes the unlisted codings");
+  check(choose_coding("identity;q=0.5, gzip;q=0.4", gzip_only) ==
+            ContentCoding::IDENTITY,
+        "identity preferred");
+  check(choose_coding("gzip;q=0.001", gzip_only) == ContentCoding::GZIP,
+        "lowest quality still acceptable");
+  check(choose_coding("gzip;q=2", gzip_only) == ContentCoding::IDENTITY,
+        "malformed quality refuses the coding");
+
+  check(coding_name(ContentCoding::GZIP) == "gzip", "gzip name");
+  check(coding_suffix(ContentCoding::BROTLI) == ".br", "brotli suffix");
+  check(coding_suffix(ContentCoding::IDENTITY).empty(), "identity suffix");
+  return report("content_coding");
+}
@@ -0,0 +1,104 @@
+#include "request_parser.hpp"
+#include "test.hpp"
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Parses a complete head in one go
+ParseStatus parse(std::string_view head, RequestView &view,
+                  unsigned int &status) {
+  RequestParser parser;
+  ParseStatus result = parser.parse(head);
+  status = parser.error_status();
+  if (result == ParseStatus::COMPLETE)
+    parser.view(head.substr(0, parser.head_size()), view);
+  return result;
+}
+
+bool rejected(std::string_view head, unsigned int expected_status) {
+  RequestView view;
+  unsigned int status;
+  return parse(head, view, status) == ParseStatus::FAILED &&
+         status == expected_status;
+}
+
+// The Content-Length the headers agree on, nullopt if they don't
+std::optional<std::optional<std::size_t>>
+content_length(std::string_view head) {
+  RequestView view;
+  unsigned int status;
+  if (parse(head, view, status) != ParseStatus::COMPLETE)
+    return std::nullopt;
+  std::optional<std::size_t> length;
+  if (!find_content_length(view, length))
+    return std::nullopt;
+  return length;
+}
+
+void test_heads() {
+  RequestView view;
+  unsigned int status;
+  std::string head = "GET /index.html HTTP/1.1\r\nHost: x\r\n"
+                     "Accept-Encoding:  gzip \r\n\r\n";
+  check(parse(head, view, status) == ParseStatus::COMPLETE, "simple GET");
+  check(view.method == "GET" && view.target == "/index.html" &&
+            view.version == "HTTP/1.1",
+        "request line");
+  check(view.header(KnownHeader::ACCEPT_ENCODING) == "gzip",
+        "header value without whitespace");
+  check(view.header("host") == "x", "header lookup ignores the case");
+
+  // Fed byte by byte, the CR of the line end arrives alone
+  RequestParser parser;
+  ParseStatus result = ParseStatus::INCOMPLETE;
+  for (std::size_t i = 1; i <= head.size(); ++i) {
+    result = parser.parse(std::string_view(head).substr(0, i));
+    if (i < head.size() && result != ParseStatus::INCOMPLETE)
+      break;
+  }
+  check(result == ParseStatus::COMPLETE && parser.head_size() == head.size(),
+        "head fed byte by byte");
+
+  check(rejected("GET /a HTTP/1.1\nHost: x\r\n\r\n", 400), "bare LF");
+  check(rejected("GET /a HTTP/1.1\r\nHost: x\ry\r\n\r\n", 400), "bare CR");
+  check(rejected("G(T /a HTTP/1.1\r\n\r\n", 400), "method not a token");
+  check(rejected("GET  /a HTTP/1.1\r\n\r\n", 400), "double space");
+  check(rejected("GET http://x/a HTTP/1.1\r\n\r\n", 400), "absolute form");
+  check(rejected("GET /a HTTP/2.0\r\n\r\n", 505), "unsupported version");
+  check(rejected("GET /a HTTP/1.1\r\nHost x\r\n\r\n", 400), "no colon");
+  check(rejected("GET /a HTTP/1.1\r\nHost : x\r\n\r\n", 400),
+        "whitespace before the colon");
+
+  std::string many = "GET /a HTTP/1.1\r\n";
+  for (std::size_t i = 0; i <= MAX_HEADERS; ++i)
+    many += "X-Header: " + std::to_string(i) + "\r\n";
+  check(rejected(many + "\r\n", 431), "too many headers");
+}
+
+void test_content_length() {
+  std::string_view start = "POST /a HTTP/1.1\r\n";
+  auto length = [&](std::string_view headers) {
+    return content_length(std::string(start) + std::string(headers) + "\r\n");
+  };
+  check(length("") && !*length(""), "no Content-Length");
+  check(length("Content-Length: 42\r\n") == std::optional<std::size_t>(42),
+        "single Content-Length");
+  check(length("Content-Length: 5\r\ncontent-length: 5\r\n") ==
+            std::optional<std::size_t>(5),
+        "repeated equal Content-Length");
+  check(length("Content-Length: 5, 5\r\n") == std::optional<std::size_t>(5),
+        "equal list items");
+  check(!length("Content-Length: 5\r\nContent-Length: 6\r\n"),
+        "conflicting Content-Length headers");
+  check(!length("Content-Length: 5, 6\r\n"), "conflicting list items");
+  check(!length("Content-Length: 5,\r\n"), "empty list item");
+  check(!length("Content-Length: +5\r\n"), "sign");
+  check(!length("Content-Length: 0x5\r\n"), "hex");
+  check(!length("Content-Length: 99999999999999999999\r\n"), "overflow");
+}
+
+int main() {
+  test_heads();
+  test_content_length();
+  return report("request_parser");
+}
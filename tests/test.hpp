@@ -0,0 +1,32 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <iostream>
+#include <string_view>
+
+/*
+ * The checks of a test program. Every program in tests/ is run by
+ * `make test` and fails with the number of failed checks.
+ */
+inline int failed_checks = 0;
+inline int passed_checks = 0;
+
+inline void check(bool condition, std::string_view name) {
+  if (condition) {
+    ++passed_checks;
+    return;
+  }
+  ++failed_checks;
+  std::cerr << "[FAIL] " << name << "\n";
+}
+
+/*
+ * @return The exit status of the test program
+ */
+inline int report(std::string_view program) {
+  std::cout << "[TEST] " << program << ": " << passed_checks << " passed, "
+            << failed_checks << " failed\n";
+  return failed_checks == 0 ? 0 : 1;
+}
+
+#endif // !TEST_H